@@ -38,6 +38,7 @@
         inherit (pkgs-i386) gcc binutils gdb;
 
         xenia-i386 = pkgs.callPackage ./nix/kernel.nix { };
+        xenia-i386-instrumented = pkgs.callPackage ./nix/kernel.nix { instrument = true; };
 
         default = xenia-i386;
       };
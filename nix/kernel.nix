@@ -1,9 +1,11 @@
-{ stdenvNoCC
+{ lib
+, stdenvNoCC
 , pkgs-i386
 , nasm
+, instrument ? false # Function-level cycle accounting, see src/kernel/instrument.h
 }:
 stdenvNoCC.mkDerivation {
-  name = "xenia-i386";
+  name = "xenia-i386" + lib.optionalString instrument "-instrumented";
   src = ../src;
 
   preferLocalBuild = true;
@@ -15,10 +17,12 @@ stdenvNoCC.mkDerivation {
     cp ${./Makefile} Makefile
   '';
 
+  makeFlags = lib.optional instrument "INSTRUMENT=1";
+
   buildPhase = ''
-    make os-image.bin
-    make kernel.bin
-    make kernel.elf
+    make $makeFlags os-image.bin
+    make $makeFlags kernel.bin
+    make $makeFlags kernel.elf
   '';
 
   installPhase = ''
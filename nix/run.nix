@@ -8,13 +8,16 @@ let
   tmp = "tmp=$(mktemp -d --tmpdir xenia-i386-kernel.XXXX); cd $tmp";
   i386 = "${pkgs.qemu}/bin/qemu-system-i386";
   qemuArgs = "-boot order=a -drive file=os-image.bin,index=0,if=floppy,format=raw -smp 4";
+
+  # The boot script goes in the last 8 of the 320 kernel sectors (after the boot sector), see src/kernel/batch.h
+  scriptSector = "313";
 in
 lib.mapAttrs (name: value: { type = "app"; program = lib.getExe value; }) {
   vga = writeShellScriptBin "vga" ''
     ${tmp}
     cp ${drv}/os-image.bin .
     chmod u+rwx os-image.bin
-    ${i386} -vga std ${qemuArgs}
+    ${i386} -vga std -debugcon stdio ${qemuArgs}
   '';
 
   curses = writeShellScriptBin "curses" ''
@@ -31,6 +34,18 @@ lib.mapAttrs (name: value: { type = "app"; program = lib.getExe value; }) {
     ${i386} -display curses -s ${qemuArgs}
   '';
 
+  # Runs a command script (by default bench.txt) headless, with its output on stdout, and exits with its status
+  batch = writeShellScriptBin "batch" ''
+    script=$(realpath "''${1:-${./bench.txt}}")
+    ${tmp}
+    cp ${drv}/os-image.bin .
+    chmod u+rwx os-image.bin
+    { echo '#!xenia'; head -c 4000 "$script"; printf '\0'; } \
+      | dd of=os-image.bin bs=512 seek=${scriptSector} conv=notrunc status=none
+    ${i386} -display none -debugcon stdio -device isa-debug-exit,iobase=0xf4,iosize=0x04 ${qemuArgs}
+    exit $(( $? >> 1 ))
+  '';
+
   gdb = writeShellScriptBin "gdb" ''
     ${tmp}
     cp ${drv}/kernel.elf .
@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+"""Turns a 'trace dump' from the debug port into Chrome trace-viewer JSON (chrome://tracing, Perfetto)
+
+    nix run .#batch -- nix/trace.txt > debug.log
+    python3 nix/trace_to_chrome.py debug.log [kernel.elf] > trace.json
+
+Anything else on the debug port is skipped. With kernel.elf, task addresses are named from its symbols.
+"""
+import bisect
+import json
+import struct
+import subprocess
+import sys
+
+RECORD = struct.Struct("<QIHBB")  # trace_record in src/libc/trace.h
+
+
+def load_symbols(elf):
+    symbols = []
+    for line in subprocess.run(["nm", "-n", "--defined-only", elf], capture_output=True, text=True).stdout.splitlines():
+        parts = line.split()
+        if len(parts) == 3 and parts[1] in "tT":
+            symbols.append((int(parts[0], 16), parts[2]))
+    return symbols
+
+
+def namer(symbols):
+    addresses = [address for address, _ in symbols]
+
+    def name(address):
+        i = bisect.bisect_right(addresses, address) - 1
+        return symbols[i][1] if i >= 0 else hex(address)
+
+    return name if symbols else hex
+
+
+def convert(lines, name):
+    header = None
+    records = []
+    for line in lines:
+        line = line.strip()
+        if line.startswith('{"trace":"begin"'):
+            header = json.loads(line)
+            records = []
+        elif line.startswith("trace ") and header is not None:
+            records.append(RECORD.unpack(bytes.fromhex(line[6:])))
+
+    if header is None:
+        sys.exit("No trace dump found")
+
+    events = header["events"]
+    cycles_per_us = header["khz"] / 1000 or 1
+    start = records[0][0] if records else 0
+
+    out = []
+    for timestamp, arg, extra, event, cpu in records:
+        base = {"ts": (timestamp - start) / cycles_per_us, "pid": 0, "tid": cpu}
+        kind = events[event]
+        if kind in ("irq_entry", "irq_exit"):
+            out.append(dict(base, name="irq %d" % (arg - 32), ph="B" if kind == "irq_entry" else "E"))
+        elif kind in ("dispatch", "dispatch_end"):
+            out.append(dict(base, name=name(arg), cat="task", ph="B" if kind == "dispatch" else "E"))
+        elif kind == "schedule":
+            out.append(dict(base, name="schedule", ph="i", s="t", args={"task": name(arg), "priority": extra}))
+        elif kind == "kmalloc":
+            out.append(dict(base, name="kmalloc", ph="i", s="t", args={"address": hex(arg), "size": extra}))
+        elif kind == "kfree":
+            out.append(dict(base, name="kfree", ph="i", s="t", args={"address": hex(arg)}))
+        elif kind == "key":
+            released = bool(extra & 1)
+            out.append(dict(base, name="key up" if released else "key down", ph="i", s="t", args={"keycode": hex(arg)}))
+
+    # A ring can start part way through a span, drop ends without a beginning so the viewer doesn't choke
+    open_spans = {}
+    balanced = []
+    for event in out:
+        key = (event["tid"], event["name"])
+        if event["ph"] == "B":
+            open_spans[key] = open_spans.get(key, 0) + 1
+        elif event["ph"] == "E":
+            if open_spans.get(key, 0) == 0:
+                continue
+            open_spans[key] -= 1
+        balanced.append(event)
+
+    return {"traceEvents": balanced, "displayTimeUnit": "ns"}
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+    with open(sys.argv[1], errors="replace") as log:
+        lines = log.readlines()
+    symbols = load_symbols(sys.argv[2]) if len(sys.argv) > 2 else []
+    json.dump(convert(lines, namer(symbols)), sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,6 +1,7 @@
 ; Identical to lesson 13's boot sector, but the %included files have new paths
 [org 0x7c00]
 KERNEL_OFFSET equ 0x8000 ; The same one we used when linking the kernel
+KERNEL_SECTORS equ 320 ; 160KiB, up to 0x30000: the kernel and its BSS, then an optional boot script in the last 4KiB
 
     mov [BOOT_DRIVE], dl ; Remember that the BIOS sets us the boot drive in 'dl' on boot
     mov bp, 0x7000
@@ -27,8 +28,9 @@ load_kernel:
     call print
     call print_nl
 
-    mov bx, KERNEL_OFFSET ; Read from disk and store in 0x8000
-    mov dh, 63 ; Our future kernel will be larger, make this big
+    mov ax, KERNEL_OFFSET >> 4 ; Read from disk and store in 0x8000
+    mov es, ax
+    mov cx, KERNEL_SECTORS ; Anything past the end of the image is read back as zeros
     mov dl, [BOOT_DRIVE]
     call disk_load
     ret
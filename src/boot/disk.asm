@@ -1,28 +1,50 @@
-; load 'dh' sectors from drive 'dl' into ES:BX
+SECTORS_PER_TRACK equ 18 ; 1.44MB floppy geometry
+HEADS equ 2
+
+; load 'cx' sectors from drive 'dl' into ES:0, starting right after the boot sector
+; Sectors are read one at a time, so a read never crosses a track or a 64KiB DMA boundary,
+; and the kernel can be larger than what fits below 0x10000
 disk_load:
     pusha
-    ; reading from disk requires setting specific values in all registers
-    ; so we will overwrite our input parameters from 'dx'. Let's save it
-    ; to the stack for later use.
-    push dx
-
-    mov ah, 0x02 ; ah <- int 0x13 function. 0x02 = 'read'
-    mov al, dh   ; al <- number of sectors to read (0x01 .. 0x80)
+    push es
+    mov di, cx   ; di <- sectors left to read
+    mov bx, 0x00 ; [es:bx] <- pointer to buffer where the data will be stored
+                 ; caller sets es for us, and we move it forward after every sector
+    mov ch, 0x00 ; ch <- cylinder (0x0 .. 0x3FF, upper 2 bits in 'cl')
+    mov dh, 0x00 ; dh <- head number (0x0 .. 0xF)
     mov cl, 0x02 ; cl <- sector (0x01 .. 0x11)
                  ; 0x01 is our boot sector, 0x02 is the first 'available' sector
-    mov ch, 0x00 ; ch <- cylinder (0x0 .. 0x3FF, upper 2 bits in 'cl')
     ; dl <- drive number. Our caller sets it as a parameter and gets it from BIOS
     ; (0 = floppy, 1 = floppy2, 0x80 = hdd, 0x81 = hdd2)
-    mov dh, 0x00 ; dh <- head number (0x0 .. 0xF)
 
-    ; [es:bx] <- pointer to buffer where the data will be stored
-    ; caller sets it up for us, and it is actually the standard location for int 13h
+disk_load_sector:
+    mov ah, 0x02 ; ah <- int 0x13 function. 0x02 = 'read'
+    mov al, 0x01 ; al <- number of sectors to read
     int 0x13      ; BIOS interrupt
     jc disk_error ; if error (stored in the carry bit)
 
-    pop dx
-    cmp al, dh    ; BIOS also sets 'al' to the # of sectors read. Compare it.
+    cmp al, 0x01  ; BIOS also sets 'al' to the # of sectors read. Compare it.
     jne sectors_error
+
+    mov ax, es   ; Move the buffer forward by one sector (0x20 paragraphs of 16 bytes)
+    add ax, 0x20
+    mov es, ax
+
+    inc cl       ; Next sector, wrapping onto the other head and then the next cylinder
+    cmp cl, SECTORS_PER_TRACK + 1
+    jne disk_load_next
+    mov cl, 0x01
+    inc dh
+    cmp dh, HEADS
+    jne disk_load_next
+    mov dh, 0x00
+    inc ch
+
+disk_load_next:
+    dec di
+    jnz disk_load_sector
+
+    pop es
     popa
     ret
 
@@ -0,0 +1,117 @@
+#include "clock.h"
+#include "../libc/seqlock.h"
+#include "info.h"
+#include "ports.h"
+
+/* PIT channel 2 is gated from port 0x61, and its output can be read back there, so it can be polled
+ * without an interrupt. Mode 0 raises the output once the count runs out. */
+#define PIT_HZ 1193182
+#define PIT_CHANNEL2 0x42
+#define PIT_COMMAND 0x43
+#define PIT_CHANNEL2_ONESHOT 0xB0 // Channel 2, low then high byte, mode 0
+#define SPEAKER_PORT 0x61
+#define CHANNEL2_GATE 0x01
+#define SPEAKER_ENABLE 0x02
+#define CHANNEL2_OUTPUT 0x20
+
+#define CALIBRATION_COUNT (PIT_HZ / 100) // 10ms
+#define CALIBRATION_RUNS 3
+
+static uint64_t boot_cycles;
+static uint32_t khz = 0;
+static uint32_t mult = 0; /* Nanoseconds per cycle, << CLOCK_SHIFT */
+
+static seqlock clock_lock = SEQLOCK_INIT;
+static uint64_t base_cycles;
+static uint64_t base_ns;
+static uint32_t base_fraction; /* Of a nanosecond, << CLOCK_SHIFT */
+
+/* Cycles the TSC runs while PIT channel 2 counts CALIBRATION_COUNT down */
+static uint64_t measure_pit_window() {
+    uint8_t speaker = port_byte_in(SPEAKER_PORT);
+    port_byte_out(SPEAKER_PORT, (speaker & ~SPEAKER_ENABLE) | CHANNEL2_GATE);
+
+    port_byte_out(PIT_COMMAND, PIT_CHANNEL2_ONESHOT);
+    port_byte_out(PIT_CHANNEL2, CALIBRATION_COUNT & 0xFF);
+    port_byte_out(PIT_CHANNEL2, CALIBRATION_COUNT >> 8);
+
+    uint64_t start = rdtsc();
+    while (!(port_byte_in(SPEAKER_PORT) & CHANNEL2_OUTPUT))
+        ;
+    uint64_t cycles = rdtsc() - start;
+
+    port_byte_out(SPEAKER_PORT, speaker);
+    return cycles;
+}
+
+/**
+ * Calibrates the TSC, before interrupts are on
+ * The shortest of a few windows is the one least stretched by anything else (e.g. the host, under a VM)
+ */
+void init_clock() {
+    uint64_t cycles = measure_pit_window();
+    for (int i = 1; i < CALIBRATION_RUNS; i++) {
+        uint64_t run = measure_pit_window();
+        if (run < cycles)
+            cycles = run;
+    }
+
+    khz = (uint32_t)(cycles * PIT_HZ / CALIBRATION_COUNT / 1000);
+    if (khz == 0)
+        return;
+    mult = (uint32_t)((1000000ull << CLOCK_SHIFT) / khz);
+
+    boot_cycles = base_cycles = rdtsc();
+    base_ns = 0;
+    base_fraction = 0;
+}
+
+/* Nanoseconds from 'base' to 'cycles', with the base's fraction, still << CLOCK_SHIFT */
+static uint64_t scaled_since(uint64_t base, uint32_t fraction, uint64_t cycles) {
+    uint64_t delta = cycles > base ? cycles - base : 0;
+    return delta * mult + fraction;
+}
+
+/**
+ * Moves the base up to now, from the timer IRQ with interrupts off
+ */
+void clock_update() {
+    if (mult == 0)
+        return;
+
+    uint64_t now = rdtsc();
+    uint64_t scaled = scaled_since(base_cycles, base_fraction, now);
+
+    seq_write_begin(&clock_lock);
+    base_cycles = now;
+    base_ns += scaled >> CLOCK_SHIFT;
+    base_fraction = scaled & ((1u << CLOCK_SHIFT) - 1);
+    seq_write_end(&clock_lock);
+}
+
+/* TSC cycles since the clock was calibrated */
+uint64_t clock_cycles() {
+    return rdtsc() - boot_cycles;
+}
+
+/* Nanoseconds since the clock was calibrated, 0 if it couldn't be */
+uint64_t clock_ns() {
+    uint64_t cycles, ns;
+    uint32_t fraction, sequence;
+    do {
+        sequence = seq_read_begin(&clock_lock);
+        cycles = base_cycles;
+        ns = base_ns;
+        fraction = base_fraction;
+    } while (seq_read_retry(&clock_lock, sequence));
+
+    return ns + (scaled_since(cycles, fraction, rdtsc()) >> CLOCK_SHIFT);
+}
+
+uint64_t cycles_to_ns(uint64_t cycles) {
+    return cycles * mult >> CLOCK_SHIFT;
+}
+
+uint32_t clock_khz() {
+    return khz;
+}
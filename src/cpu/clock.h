@@ -0,0 +1,21 @@
+#ifndef CLOCK_H_
+#define CLOCK_H_
+
+#include "types.h"
+
+/* The clocksource: a 64 bit monotonic clock off the TSC, calibrated against PIT channel 2 at boot
+ *
+ * Nanoseconds are a base the timer IRQ moves on every tick, plus the cycles since scaled by mult >> CLOCK_SHIFT.
+ * Keeping the base recent keeps that product well inside 64 bits, and the IRQ publishes it under a seqlock so
+ * readers anywhere get a matching pair. The base carries its fraction of a nanosecond, so it never steps back. */
+#define CLOCK_SHIFT 22
+
+void init_clock();
+void clock_update();
+
+uint64_t clock_cycles();
+uint64_t clock_ns();
+uint64_t cycles_to_ns(uint64_t cycles);
+uint32_t clock_khz();
+
+#endif // CLOCK_H_
@@ -8,6 +8,15 @@ cpuid_registers cpuid(uint32_t input_eax, uint32_t input_ecx) {
     return registers;
 }
 
+/**
+ * Reads the processor's time-stamp counter, which counts core clock cycles since reset
+ */
+uint64_t rdtsc() {
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
 cpu_information cpu_info() {
     cpuid_registers registers = cpuid(1, 0);
 
@@ -33,4 +33,6 @@ typedef struct CpuInformation {
 cpuid_registers cpuid(uint32_t eax, uint32_t ecx);
 cpu_information cpu_info();
 
+uint64_t rdtsc();
+
 #endif // INFO_H_
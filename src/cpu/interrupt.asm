@@ -11,8 +11,7 @@ isr_common_stub:
     mov ax, 0x10  ; kernel data segment descriptor
     mov ds, ax
     mov es, ax
-    mov fs, ax
-    mov gs, ax
+    mov fs, ax    ; not gs, it's the CPU's own segment (see smp.c)
 
     ; 2. Call C handler
     call isr_handler
@@ -22,7 +21,6 @@ isr_common_stub:
     mov ds, ax
     mov es, ax
     mov fs, ax
-    mov gs, ax
     popa
     add esp, 8 ; Cleans up the pushed error code and pushed ISR number
     sti
@@ -38,13 +36,11 @@ irq_common_stub:
     mov ds, ax
     mov es, ax
     mov fs, ax
-    mov gs, ax
     call irq_handler ; Different than the ISR code
     pop ebx  ; Different than the ISR code
     mov ds, bx
     mov es, bx
     mov fs, bx
-    mov gs, bx
     popa
     add esp, 8
     sti
@@ -136,3 +132,21 @@ IRQ 12, 44
 IRQ 13, 45
 IRQ 14, 46
 IRQ 15, 47
+IRQ 16, 48 ; Local APIC timer
+
+; Sent to wake an AP out of hlt (see cpu_sleep), taking it is all it's for
+[extern lapic_write]
+[GLOBAL wake_ipi]
+wake_ipi:
+    pusha
+    push dword 0
+    push dword 0xB0 ; LAPIC_EOI
+    call lapic_write
+    add esp, 8
+    popa
+    iret
+
+; The local APIC's spurious vector: there's nothing in service, so nothing to do and no EOI to send
+[GLOBAL lapic_spurious]
+lapic_spurious:
+    iret
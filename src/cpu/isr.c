@@ -1,12 +1,16 @@
 #include "isr.h"
 #include "../drivers/keyboard.h"
 #include "../drivers/screen.h"
+#include "../libc/irqsoff.h"
 #include "../libc/string.h"
+#include "../libc/trace.h"
 #include "idt.h"
 #include "ports.h"
+#include "smp.h"
 #include "timer.h"
 
 isr_t interrupt_handlers[256];
+volatile uint32_t interrupt_counts[256];
 
 #define PIC1 0x20
 #define PIC2 0xA0
@@ -94,6 +98,9 @@ void isr_install() {
     IRQ_GATE(45, 13);
     IRQ_GATE(46, 14);
     IRQ_GATE(47, 15);
+    IRQ_GATE(48, 16);
+    set_idt_gate(WAKE_VECTOR, (size_t)wake_ipi);
+    set_idt_gate(LAPIC_SPURIOUS_VECTOR, (size_t)lapic_spurious);
 
     set_idt(); // Load with ASM
 }
@@ -149,17 +156,37 @@ void register_interrupt_handler(uint8_t n, isr_t handler) {
 }
 
 void irq_handler(registers_t r) {
+    TRACE(TRACE_IRQ_ENTRY, r.int_no, 0);
+    IRQSOFF_BEGIN(interrupt_handlers[r.int_no] != 0 ? (uint32_t)interrupt_handlers[r.int_no] : (uint32_t)&irq_handler);
+    interrupt_counts[r.int_no]++;
+
     /* After every interrupt we need to send an EOI to the PICs
      * or they will not send another interrupt again */
-    if (r.int_no >= 40)
-        port_byte_out(0xA0, 0x20); /* slave */
-    port_byte_out(0x20, 0x20);     /* master */
+    if (r.int_no >= IRQ16) {
+        lapic_write(LAPIC_EOI, 0); /* local APIC */
+    } else {
+        if (r.int_no >= 40)
+            port_byte_out(0xA0, 0x20); /* slave */
+        port_byte_out(0x20, 0x20);     /* master */
+    }
 
     /* Handle the interrupt in a more modular way */
     if (interrupt_handlers[r.int_no] != 0) {
         isr_t handler = interrupt_handlers[r.int_no];
         handler(r);
     }
+    TRACE(TRACE_IRQ_EXIT, r.int_no, 0);
+    IRQSOFF_END();
+}
+
+/**
+ * Masks or unmasks one of the 16 PIC lines
+ */
+void set_irq_masked(uint8_t irq, bool masked) {
+    uint16_t port = (irq < 8 ? PIC1 : PIC2) | DATA;
+    uint8_t bit = 1 << (irq & 7);
+    uint8_t mask = port_byte_in(port);
+    port_byte_out(port, masked ? mask | bit : mask & ~bit);
 }
 
 void irq_install() {
@@ -54,6 +54,9 @@ extern void irq12();
 extern void irq13();
 extern void irq14();
 extern void irq15();
+extern void irq16();
+extern void lapic_spurious();
+extern void wake_ipi();
 
 #define IRQ0 32
 #define IRQ1 33
@@ -71,6 +74,9 @@ extern void irq15();
 #define IRQ13 45
 #define IRQ14 46
 #define IRQ15 47
+#define IRQ16 48 /* The local APIC timer, which doesn't go through the PICs */
+#define WAKE_VECTOR 0x40 /* IPIs that wake a sleeping AP, see cpu_sleep */
+#define LAPIC_SPURIOUS_VECTOR 0xFF /* Has to end in 1111 on older APICs, its gate is lapic_spurious */
 
 /* Struct which aggregates many registers */
 typedef struct {
@@ -87,8 +93,12 @@ typedef struct {
 void isr_install();
 void isr_handler(registers_t r);
 void irq_install();
+void set_irq_masked(uint8_t irq, bool masked);
 
 typedef void (*isr_t)(registers_t);
 void register_interrupt_handler(uint8_t n, isr_t handler);
 
+/* How many times each IRQ vector has fired since boot */
+extern volatile uint32_t interrupt_counts[256];
+
 #endif
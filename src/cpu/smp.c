@@ -0,0 +1,354 @@
+#include "smp.h"
+#include "../drivers/screen.h"
+#include "../libc/atomic.h"
+#include "../libc/function.h"
+#include "../libc/mem.h"
+#include "../libc/string.h"
+#include "idt.h"
+#include "isr.h"
+#include "timer.h"
+
+cpu cpus[MAX_CPUS];
+static int found = 1; /* The bootstrap processor, whether or not there's an MADT */
+
+/* GDT: null, flat code, flat data, then a data segment over each cpu struct */
+#define GDT_ENTRIES (3 + MAX_CPUS)
+
+static uint64_t gdt[GDT_ENTRIES];
+
+typedef struct {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed)) gdt_register_t;
+
+static gdt_register_t gdt_reg;
+
+static uint64_t segment(uint32_t base, uint32_t limit, uint8_t access, uint8_t flags) {
+    return (uint64_t)(limit & 0xFFFF) | (uint64_t)(base & 0xFFFFFF) << 16 | (uint64_t)access << 40 |
+        (uint64_t)((limit >> 16) & 0xF) << 48 | (uint64_t)(flags & 0xF) << 52 | (uint64_t)(base >> 24) << 56;
+}
+
+static void load_cpu_segment(uint32_t index) {
+    asm volatile("mov %0, %%gs" : : "r"(CPU_SELECTOR(index)));
+}
+
+/**
+ * Swaps the boot sector's GDT for one with a segment per CPU, and points the bootstrap processor's gs at its own
+ * Has to come before anything calls this_cpu
+ */
+void init_gdt() {
+    gdt[0] = 0;
+    gdt[1] = segment(0, 0xFFFFF, 0x9A, 0xC); // Code: present, ring 0, readable; 4K granularity, 32 bit
+    gdt[2] = segment(0, 0xFFFFF, 0x92, 0xC); // Data: present, ring 0, writable
+    for (int i = 0; i < MAX_CPUS; i++) {
+        cpus[i].self = &cpus[i];
+        cpus[i].index = i;
+        gdt[3 + i] = segment((uint32_t)&cpus[i], sizeof(cpu) - 1, 0x92, 0x4); // Byte granularity
+    }
+
+    gdt_reg.limit = sizeof(gdt) - 1;
+    gdt_reg.base = (uint32_t)&gdt;
+    asm volatile("lgdt %0\n"
+                 "ljmp $0x08, $1f\n"
+                 "1:\n"
+                 "mov %1, %%ds\n"
+                 "mov %1, %%es\n"
+                 "mov %1, %%fs\n"
+                 "mov %1, %%ss\n"
+                 :
+                 : "m"(gdt_reg), "r"(KERNEL_DS));
+    load_cpu_segment(0);
+
+    cpus[0].online = true;
+}
+
+NO_INSTRUMENT cpu *this_cpu() {
+    cpu *current;
+    asm volatile("mov %%gs:0, %0" : "=r"(current));
+    return current;
+}
+
+int cpu_count() {
+    return found;
+}
+
+int online_cpus() {
+    int online = 0;
+    for (int i = 0; i < found; i++)
+        online += cpus[i].online;
+    return online;
+}
+
+/* ACPI tables, just as far as finding the MADT needs */
+typedef struct {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+} __attribute__((packed)) acpi_rsdp;
+
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_header;
+
+typedef struct {
+    acpi_header header;
+    uint32_t lapic_address;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt;
+
+#define MADT_LOCAL_APIC 0
+#define MADT_LAPIC_OVERRIDE 5
+#define LOCAL_APIC_ENABLED 0x1
+#define LOCAL_APIC_ONLINE_CAPABLE 0x2
+
+static bool checksum_ok(const void *table, uint32_t length) {
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++)
+        sum += ((const uint8_t *)table)[i];
+    return sum == 0;
+}
+
+static const acpi_rsdp *scan_rsdp(uint32_t start, uint32_t end) {
+    for (uint32_t address = start; address < end; address += 16) {
+        const acpi_rsdp *rsdp = (const acpi_rsdp *)address;
+        if (strncmp(rsdp->signature, "RSD PTR ", 8) == 0 && checksum_ok(rsdp, sizeof(acpi_rsdp)))
+            return rsdp;
+    }
+    return NULL;
+}
+
+/**
+ * The RSDP is on a 16 byte boundary in the first KB of the EBDA, or in the BIOS area below 1MB
+ */
+static const acpi_rsdp *find_rsdp() {
+    uint32_t ebda = (uint32_t)(*(const uint16_t *)0x40E) << 4;
+    const acpi_rsdp *rsdp = ebda != 0 ? scan_rsdp(ebda, ebda + 1024) : NULL;
+    return rsdp != NULL ? rsdp : scan_rsdp(0xE0000, 0x100000);
+}
+
+static const acpi_madt *find_madt() {
+    const acpi_rsdp *rsdp = find_rsdp();
+    if (rsdp == NULL)
+        return NULL;
+
+    const acpi_header *rsdt = (const acpi_header *)rsdp->rsdt_address;
+    if (strncmp(rsdt->signature, "RSDT", 4) != 0 || !checksum_ok(rsdt, rsdt->length))
+        return NULL;
+
+    const uint32_t *entries = (const uint32_t *)(rsdt + 1);
+    int count = (rsdt->length - sizeof(acpi_header)) / 4;
+    for (int i = 0; i < count; i++) {
+        const acpi_header *table = (const acpi_header *)entries[i];
+        if (strncmp(table->signature, "APIC", 4) == 0 && checksum_ok(table, table->length))
+            return (const acpi_madt *)table;
+    }
+    return NULL;
+}
+
+#define ICR_INIT 0x00004500    // INIT, level assert
+#define ICR_STARTUP 0x00004600 // Start-up, the vector is the low byte
+#define ICR_FIXED 0x00004000   // The vector is the low byte
+#define ICR_PENDING 0x00001000 // Delivery status
+
+static volatile uint8_t *lapic = (volatile uint8_t *)0xFEE00000;
+
+uint32_t lapic_read(uint32_t reg) {
+    return *(volatile uint32_t *)(lapic + reg);
+}
+
+void lapic_write(uint32_t reg, uint32_t value) {
+    *(volatile uint32_t *)(lapic + reg) = value;
+}
+
+/**
+ * Reads the enabled (or able to be brought online) local APICs out of the MADT, the bootstrap processor first
+ */
+static void discover_cpus() {
+    const acpi_madt *madt = find_madt();
+    if (madt == NULL)
+        return;
+
+    lapic = (volatile uint8_t *)madt->lapic_address;
+
+    const uint8_t *entry = (const uint8_t *)(madt + 1);
+    const uint8_t *end = (const uint8_t *)madt + madt->header.length;
+    for (; entry < end && entry[1] != 0; entry += entry[1]) {
+        if (entry[0] == MADT_LAPIC_OVERRIDE)
+            lapic = (volatile uint8_t *)*(const uint32_t *)&entry[4]; // Only the low half is reachable anyway
+    }
+
+    cpus[0].apic_id = lapic_read(LAPIC_ID) >> 24;
+
+    entry = (const uint8_t *)(madt + 1);
+    for (; entry < end && entry[1] != 0; entry += entry[1]) {
+        if (entry[0] != MADT_LOCAL_APIC || found == MAX_CPUS)
+            continue;
+
+        uint8_t apic_id = entry[3];
+        uint32_t flags = *(const uint32_t *)&entry[4];
+        if (apic_id != cpus[0].apic_id && (flags & (LOCAL_APIC_ENABLED | LOCAL_APIC_ONLINE_CAPABLE)))
+            cpus[found++].apic_id = apic_id;
+    }
+}
+
+static void send_ipi(uint8_t apic_id, uint32_t command) {
+    lapic_write(LAPIC_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING)
+        cpu_relax();
+}
+
+/**
+ * The trampoline, copied to TRAMPOLINE_ADDRESS and entered in real mode with cs:ip at its start
+ * Everything it addresses is relative to where it's copied to, and the slots at the end are filled in per AP
+ */
+extern char smp_trampoline[], smp_trampoline_end[], trampoline_gdt[], trampoline_stack[], trampoline_cpu[],
+    trampoline_entry[];
+asm(".code16\n"
+    "smp_trampoline:\n"
+    "    cli\n"
+    "    mov %cs, %ax\n"
+    "    mov %ax, %ds\n"
+    "    lgdtl trampoline_gdt - smp_trampoline\n"
+    "    mov %cr0, %eax\n"
+    "    or $1, %eax\n"
+    "    mov %eax, %cr0\n"
+    "    ljmpl $0x08, $0x1000 + trampoline_32 - smp_trampoline\n"
+    ".code32\n"
+    "trampoline_32:\n"
+    "    mov $0x10, %ax\n"
+    "    mov %ax, %ds\n"
+    "    mov %ax, %es\n"
+    "    mov %ax, %fs\n"
+    "    mov %ax, %ss\n"
+    "    mov 0x1000 + trampoline_stack - smp_trampoline, %esp\n"
+    "    pushl 0x1000 + trampoline_cpu - smp_trampoline\n"
+    "    call *0x1000 + trampoline_entry - smp_trampoline\n"
+    ".align 4\n"
+    "trampoline_gdt: .word 0\n"
+    "    .long 0\n"
+    "trampoline_stack: .long 0\n"
+    "trampoline_cpu: .long 0\n"
+    "trampoline_entry: .long 0\n"
+    "smp_trampoline_end:\n");
+
+#define TRAMPOLINE_SLOT(slot) ((void *)(TRAMPOLINE_ADDRESS + ((slot) - smp_trampoline)))
+
+static action0 ap_entry;
+
+/**
+ * Where an AP lands from the trampoline, on its own stack with interrupts off, given its index into cpus
+ * The PIC only delivers to the bootstrap processor, the only interrupt an AP takes is the wake IPI
+ */
+static void ap_main(uint32_t index) {
+    cpu *self = &cpus[index];
+    load_cpu_segment(self->index);
+    asm volatile("lidt %0" : : "m"(idt_reg));
+
+    /* Its local APIC has to be on to take the IPIs that wake it from cpu_sleep */
+    lapic_write(LAPIC_SPURIOUS, LAPIC_ENABLE | LAPIC_SPURIOUS_VECTOR);
+
+    self->online = true;
+    (*ap_entry)();
+
+    while (true)
+        asm volatile("cli; hlt");
+}
+
+/**
+ * Halts an AP until wake_cpu, unless 'ready' says there's something to do after all
+ * APs run with interrupts off, and the wake IPI is the only interrupt they take, so it's the only way out.
+ * It's marked sleeping before 'ready' is asked, so anything made ready after that sends the IPI, and an IPI
+ * that lands before the hlt is held until the sti, which doesn't let it in until the hlt has started
+ */
+void cpu_sleep(bool (*ready)()) {
+    cpu *self = this_cpu();
+    atomic_exchange(&self->sleeping, true);
+    if (!ready())
+        asm volatile("sti; hlt; cli" ::: "memory");
+    atomic_store(&self->sleeping, false);
+}
+
+/**
+ * Sends a wake IPI to a CPU if it's sleeping
+ * Returns whether it was
+ */
+bool wake_cpu(int index) {
+    if (!atomic_exchange(&cpus[index].sleeping, false))
+        return false;
+
+    uint32_t flags = irq_save();
+    send_ipi(cpus[index].apic_id, ICR_FIXED | WAKE_VECTOR);
+    irq_restore(flags);
+    return true;
+}
+
+/**
+ * Where the trampoline sends an AP that turns up after it was given up on, which still has its own stack
+ */
+static void ap_park(uint32_t index) {
+    UNUSED(index);
+    while (true)
+        asm volatile("cli; hlt");
+}
+
+/**
+ * Starts every AP the MADT lists, one at a time, each running 'entry' (which shouldn't return)
+ * Needs the timer running for the delays between IPIs
+ * Returns how many CPUs are online, the bootstrap processor included
+ */
+int start_application_processors(action0 entry) {
+    discover_cpus();
+    ap_entry = entry;
+
+    memory_copy((uint8_t *)smp_trampoline, (uint8_t *)TRAMPOLINE_ADDRESS, smp_trampoline_end - smp_trampoline);
+    memory_copy((uint8_t *)&gdt_reg, (uint8_t *)TRAMPOLINE_SLOT(trampoline_gdt), sizeof(gdt_reg));
+    *(uint32_t *)TRAMPOLINE_SLOT(trampoline_entry) = (uint32_t)&ap_main;
+
+    for (int i = 1; i < found; i++) {
+        cpus[i].stack = (uint8_t *)kmalloc(AP_STACK_SIZE);
+        if (cpus[i].stack == NULL)
+            break;
+
+        *(uint32_t *)TRAMPOLINE_SLOT(trampoline_stack) = (uint32_t)(cpus[i].stack + AP_STACK_SIZE);
+        *(uint32_t *)TRAMPOLINE_SLOT(trampoline_cpu) = i;
+
+        send_ipi(cpus[i].apic_id, ICR_INIT);
+        sleep(10);
+        for (int attempt = 0; attempt < 2 && !cpus[i].online; attempt++) {
+            send_ipi(cpus[i].apic_id, ICR_STARTUP | (TRAMPOLINE_ADDRESS >> 12));
+            sleep(1);
+        }
+
+        /* Give it up to 100ms to get as far as C */
+        uint32_t start = get_tick();
+        while (!cpus[i].online && get_tick() - start < 100)
+            cpu_relax();
+
+        /* It might still be on its way through the trampoline: it keeps its stack, and is parked if it gets to
+         * the entry now. No more are started, it could pick up their slots instead of its own */
+        if (!cpus[i].online) {
+            *(uint32_t *)TRAMPOLINE_SLOT(trampoline_entry) = (uint32_t)&ap_park;
+            kprintlnf("CPU {i} (APIC {u}) didn't start, not starting any more", i, cpus[i].apic_id);
+            break;
+        }
+    }
+
+    return online_cpus();
+}
+
+void print_cpus() {
+    kprintlnf("{i} CPUs found, {i} online, local APICs at {x}", found, online_cpus(), (uint32_t)lapic);
+    for (int i = 0; i < found; i++)
+        kprintlnf("CPU {i}: APIC {u}, {}", i, cpus[i].apic_id, cpus[i].online ? "online" : "offline");
+}
@@ -0,0 +1,61 @@
+#ifndef SMP_H_
+#define SMP_H_
+
+#include "../libc/atomic.h"
+#include "../libc/function.h"
+#include "types.h"
+
+/* Symmetric multiprocessing
+ *
+ * The local APICs come from the ACPI MADT. Each application processor (AP) is started with INIT-SIPI-SIPI
+ * into a real mode trampoline copied under 1MB, which switches straight to protected mode on the kernel's
+ * GDT and jumps to the C entry point. Every CPU's gs selects a GDT segment over its own cpu struct,
+ * so this_cpu() is one load, and the interrupt stubs leave gs alone. */
+#define MAX_CPUS 8
+#define TRAMPOLINE_ADDRESS 0x1000 // Page aligned and under 1MB, the SIPI vector is its page number
+#define AP_STACK_SIZE 8192
+
+/* GDT selectors, the code and data segments are where the boot sector's were */
+#define KERNEL_DS 0x10
+#define CPU_SELECTOR(index) (0x18 + 8 * (index))
+
+/* Local APIC registers, offsets from its base */
+#define LAPIC_ID 0x20
+#define LAPIC_EOI 0xB0
+#define LAPIC_SPURIOUS 0xF0
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE 0x3E0
+
+#define LAPIC_ENABLE 0x100 // In the spurious vector register
+
+typedef struct Cpu {
+    struct Cpu *self; /* At %gs:0, see this_cpu */
+    uint32_t index;   /* 0 is the bootstrap processor */
+    uint8_t apic_id;
+    volatile bool online;
+    uint8_t *stack; /* NULL for the bootstrap processor */
+    atomic_uint sleeping; /* Halted in cpu_sleep, waiting for wake_cpu */
+    bool interactive; /* Handling input, so what it schedules is boosted, see set_interactive */
+} cpu;
+
+extern cpu cpus[MAX_CPUS];
+
+void init_gdt();
+int start_application_processors(action0 entry);
+
+uint32_t lapic_read(uint32_t reg);
+void lapic_write(uint32_t reg, uint32_t value);
+
+void cpu_sleep(bool (*ready)());
+bool wake_cpu(int index);
+
+cpu *this_cpu();
+int cpu_count();
+int online_cpus();
+void print_cpus();
+
+#endif // SMP_H_
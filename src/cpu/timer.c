@@ -1,33 +1,380 @@
 #include "timer.h"
-#include "../libc/function.h"
+#include "../kernel/coroutine.h"
+#include "../kernel/profile.h"
+#include "../kernel/scheduler.h"
+#include "../kernel/thread.h"
+#include "../kernel/waitqueue.h"
+#include "../libc/atomic.h"
+#include "clock.h"
+#include "info.h"
 #include "isr.h"
 #include "ports.h"
-#include "types.h"
+#include "smp.h"
 
-volatile uint32_t tick = 0;
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define SLOT_INDEX(expires, level) (((expires) >> (WHEEL_BITS * (level))) & WHEEL_MASK)
 
-volatile uint32_t get_tick() {
-    return tick;
+static atomic_uint tick = ATOMIC_INIT(0);
+
+static timer *wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static uint32_t wheel_tick = 0; /* The last tick the wheel has been run for */
+
+/* Tickless mode: the local APIC timer in one-shot mode stands in for the PIT
+ * Each shot covers a whole number of ticks, which go on the clock when it fires. While busy it's one tick at
+ * a time, so the wheel and preemption see every tick. Going idle stretches it to whatever's due next. */
+#define LVT_MASKED 0x10000
+#define DIVIDE_BY_16 0x3
+#define CALIBRATION_TICKS 50
+
+static uint32_t pit_divisor;
+
+static bool tickless = false;
+static uint32_t counts_per_tick = 0; /* APIC timer counts in a PIT tick, 0 until calibrated */
+static uint32_t max_shot_ticks;
+static uint32_t shot_ticks; /* Tick boundaries the running shot covers */
+
+/* Ticks of the running shot that have passed, interrupts have to be off */
+static uint32_t shot_elapsed() {
+    uint32_t current = lapic_read(LAPIC_TIMER_CURRENT);
+    return shot_ticks - (current + counts_per_tick - 1) / counts_per_tick;
+}
+
+/**
+ * Ticks since boot
+ * In tickless mode it's derived, from the ticks counted so far and how far through its shot the APIC timer is
+ * The APIC timer is the bootstrap processor's own, so only it gets the in-between ticks, the rest get the count
+ */
+uint32_t get_tick() {
+    if (!tickless || this_cpu()->index != 0)
+        return atomic_load(&tick);
+
+    uint32_t flags = irq_save();
+    uint32_t now = atomic_load(&tick) + shot_elapsed();
+    irq_restore(flags);
+    return now;
+}
+
+/**
+ * Puts a timer in the slot for its expiry, which can't be before wheel_tick
+ * Levels go by the difference from wheel_tick, so the tick counter wrapping doesn't matter
+ * One cascaded down on the tick it's due lands in the slot run_wheel is about to fire
+ * Interrupts have to be off
+ */
+static void add_timer(timer *t) {
+    uint32_t delta = t->expires - wheel_tick;
+
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1u << (WHEEL_BITS * (level + 1))))
+        level++;
+
+    timer **slot = &wheel[level][SLOT_INDEX(t->expires, level)];
+    t->next = *slot;
+    if (t->next != NULL)
+        t->next->link = &t->next;
+    *slot = t;
+    t->link = slot;
+}
+
+static void remove_timer(timer *t) {
+    *t->link = t->next;
+    if (t->next != NULL)
+        t->next->link = t->link;
+    t->link = NULL;
+}
+
+/**
+ * Spreads one slot of a level back out over the levels below it
+ */
+static void cascade(int level) {
+    timer **slot = &wheel[level][SLOT_INDEX(wheel_tick, level)];
+    timer *list = *slot;
+    *slot = NULL;
+
+    while (list != NULL) {
+        timer *next = list->next;
+        add_timer(list);
+        list = next;
+    }
+}
+
+/**
+ * Advances the wheel by a tick, firing everything due on it
+ * Timers are taken off the slot one at a time, so a function can start or cancel any timer, itself included
+ */
+static void run_wheel() {
+    wheel_tick++;
+
+    for (int level = 1; level < WHEEL_LEVELS && SLOT_INDEX(wheel_tick, level - 1) == 0; level++)
+        cascade(level);
+
+    timer **slot = &wheel[0][SLOT_INDEX(wheel_tick, 0)];
+    timer *t;
+    while ((t = *slot) != NULL) {
+        remove_timer(t);
+
+        if (t->period != 0) {
+            t->expires += t->period;
+            add_timer(t);
+        }
+        (*t->function)(t->data);
+    }
+}
+
+void timer_init(timer *t, action1 function, void *data) {
+    t->function = function;
+    t->data = data;
+    t->period = 0;
+    t->next = NULL;
+    t->link = NULL;
+}
+
+/**
+ * (Re)starts a timer to fire in 'ticks' ticks, then every 'period' ticks after that if it isn't 0
+ * Both are capped at TIMER_MAX_TICKS, and 0 ticks means the next one
+ */
+void timer_start(timer *t, uint32_t ticks, uint32_t period) {
+    uint32_t flags = irq_save();
+    if (t->link != NULL)
+        remove_timer(t);
+
+    if (ticks == 0)
+        ticks = 1;
+    t->expires = wheel_tick + (ticks < TIMER_MAX_TICKS ? ticks : TIMER_MAX_TICKS);
+    t->period = period < TIMER_MAX_TICKS ? period : TIMER_MAX_TICKS;
+    add_timer(t);
+    irq_restore(flags);
 }
 
-void wait(uint32_t ticks) {
-    uint32_t current = tick;
-    while (tick <= current + ticks) {
-        asm volatile("nop");
+/**
+ * Stops a timer, including any periodic firings
+ * Returns false if it wasn't pending
+ */
+bool timer_cancel(timer *t) {
+    uint32_t flags = irq_save();
+    bool pending = t->link != NULL;
+    if (pending)
+        remove_timer(t);
+    irq_restore(flags);
+    return pending;
+}
+
+bool timer_pending(const timer *t) {
+    return t->link != NULL;
+}
+
+static void complete_sleep(void *done) {
+    complete((completion *)done);
+}
+
+/**
+ * Parks the caller for the given number of ticks
+ * Threads sleep, letting everything else run. The boot thread can't, so it waits on a completion the timer
+ * signals, which keeps deferred interrupt work going (so key handlers still fire) and halts in between
+ */
+void sleep(uint32_t ticks) {
+    if (!thread_is_boot()) {
+        thread_sleep(ticks);
+        return;
     }
+
+    completion done;
+    init_completion(&done);
+    timer wake;
+    timer_init(&wake, &complete_sleep, &done);
+
+    timer_start(&wake, ticks, 0);
+    wait_for_completion(&done);
+}
+
+/**
+ * Finds the next tick the wheel has anything to do on, a level 0 slot firing or a higher level cascading
+ * A cascade can come before the timers in it are due, so this is sometimes early but never late
+ * Returns false if the wheel is empty
+ */
+static bool next_wheel_event(uint32_t *due) {
+    uint32_t nearest = 0;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        uint32_t shift = WHEEL_BITS * level;
+        for (uint32_t i = 1; i <= WHEEL_SIZE; i++) {
+            uint32_t at = ((wheel_tick >> shift) + i) << shift;
+            if (wheel[level][SLOT_INDEX(at, level)] != NULL) {
+                if (nearest == 0 || at - wheel_tick < nearest)
+                    nearest = at - wheel_tick;
+                break;
+            }
+        }
+    }
+
+    *due = wheel_tick + nearest;
+    return nearest != 0;
+}
+
+/* Puts ticks on the clock and runs the wheel up to it, interrupts have to be off */
+static void advance(uint32_t ticks) {
+    uint32_t now = atomic_fetch_add(&tick, ticks) + ticks;
+    account_ticks(ticks);
+    clock_update();
+
+    while (wheel_tick != now)
+        run_wheel();
 }
 
 static void timer_callback(registers_t regs) {
-    UNUSED(regs);
-    tick++;
+    if (irqsoff_tracing)
+        irqsoff_tick();
+    profile_sample(&regs);
+    advance(1);
+
+    /* After every wakeup for this tick, so they cost one reschedule between them */
+    thread_tick();
+}
+
+static void lapic_timer_callback(registers_t regs) {
+    if (!tickless)
+        return;
+
+    profile_sample(&regs);
+    uint32_t ticks = shot_ticks;
+    shot_ticks = 1;
+    lapic_write(LAPIC_TIMER_INITIAL, counts_per_tick);
+    advance(ticks);
+    thread_tick();
+}
+
+/**
+ * Reprograms the running shot to end 'ticks' tick boundaries on, keeping whatever of the current tick has gone
+ * and putting any whole ticks that have passed on the clock
+ * Leaves it alone if it's within a sliver of firing (or has), the interrupt takes care of it then
+ * Interrupts have to be off
+ */
+static void reshoot(uint32_t ticks) {
+    uint32_t current = lapic_read(LAPIC_TIMER_CURRENT);
+    if (current < counts_per_tick / 16)
+        return;
+
+    uint32_t remaining = (current + counts_per_tick - 1) / counts_per_tick;
+    uint32_t passed = shot_ticks - remaining;
+    uint32_t partial = current - (remaining - 1) * counts_per_tick;
+
+    lapic_write(LAPIC_TIMER_INITIAL, partial + (ticks - 1) * counts_per_tick);
+    shot_ticks = ticks;
+    if (passed != 0)
+        advance(passed);
+}
+
+/* At least 1, so a shot never ends in the past */
+static uint32_t ticks_until(uint32_t due, uint32_t now) {
+    int32_t left = due - now;
+    return left > 0 ? (uint32_t)left : 1;
+}
+
+/**
+ * Stretches the shot to the next timer or coroutine wakeup, before halting
+ * Interrupts have to be off
+ */
+void timer_idle_enter() {
+    if (!tickless)
+        return;
+
+    uint32_t now = get_tick();
+    uint32_t ticks = max_shot_ticks;
+    uint32_t due;
+    if (next_wheel_event(&due) && ticks_until(due, now) < ticks)
+        ticks = ticks_until(due, now);
+    if (next_coroutine_wake(&due) && ticks_until(due, now) < ticks)
+        ticks = ticks_until(due, now);
+
+    reshoot(ticks);
+}
+
+/**
+ * Back to a tick at a time, after the halt
+ * Interrupts have to be off
+ */
+void timer_idle_exit() {
+    if (tickless)
+        reshoot(1);
+}
+
+/**
+ * Measures the APIC timer against the PIT, with interrupts on and the PIT ticking
+ */
+static void calibrate_lapic_timer() {
+    lapic_write(LAPIC_SPURIOUS, LAPIC_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    lapic_write(LAPIC_TIMER_DIVIDE, DIVIDE_BY_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+
+    /* Start on a tick boundary */
+    uint32_t start = get_tick();
+    while (get_tick() == start)
+        cpu_relax();
+
+    lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+    start = get_tick();
+    while (get_tick() - start < CALIBRATION_TICKS)
+        cpu_relax();
+    uint32_t counted = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+
+    counts_per_tick = counted / CALIBRATION_TICKS;
+    if (counts_per_tick != 0)
+        max_shot_ticks = 0xFFFFFFFF / counts_per_tick - 1;
+}
+
+/**
+ * Switches between the PIT's periodic tick and the local APIC timer's one-shots
+ * The first switch to tickless calibrates the APIC timer, which takes CALIBRATION_TICKS
+ * Returns false if there's no local APIC to do it with
+ */
+bool set_tickless(bool on) {
+    if (on == tickless)
+        return true;
+
+    if (on) {
+        if (!cpu_info().apic)
+            return false;
+        if (counts_per_tick == 0)
+            calibrate_lapic_timer();
+        if (counts_per_tick == 0)
+            return false;
+    }
+
+    uint32_t flags = irq_save();
+    if (on) {
+        set_irq_masked(0, true);
+        lapic_write(LAPIC_LVT_TIMER, IRQ16); // One-shot
+        shot_ticks = 1;
+        lapic_write(LAPIC_TIMER_INITIAL, counts_per_tick);
+        tickless = true;
+    } else {
+        uint32_t passed = shot_elapsed();
+        lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+        lapic_write(LAPIC_TIMER_INITIAL, 0);
+        tickless = false;
+        advance(passed);
+        set_irq_masked(0, false);
+    }
+    irq_restore(flags);
+    return true;
+}
+
+bool is_tickless() {
+    return tickless;
+}
+
+/* TSC cycles in a PIT tick, by the clocksource's calibration */
+uint64_t tick_cycles() {
+    return (uint64_t)clock_khz() * 1000 * pit_divisor / 1193180;
 }
 
 void init_timer(uint32_t freq) {
     /* Install the function we just wrote */
     register_interrupt_handler(IRQ0, timer_callback);
+    register_interrupt_handler(IRQ16, lapic_timer_callback);
 
     /* Get the PIT value: hardware clock at 1193180 Hz */
     uint32_t divisor = 1193180 / freq;
+    pit_divisor = divisor;
     uint8_t low = (uint8_t)(divisor & 0xFF);
     uint8_t high = (uint8_t)((divisor >> 8) & 0xFF);
     /* Send the command */
@@ -1,11 +1,44 @@
 #ifndef TIMER_H
 #define TIMER_H
 
+#include "../libc/function.h"
 #include "types.h"
 
-volatile uint32_t get_tick();
+/* Timers on a hierarchical timing wheel
+ *
+ * Each level has WHEEL_SIZE slots, a slot on level n covering WHEEL_SIZE^n ticks. A timer goes in the
+ * lowest level whose span reaches its expiry, and is cascaded down a level each time the level below wraps,
+ * so starting and cancelling are O(1) and each tick only looks at one slot. Every timer due in the same tick
+ * is in the same slot, so they all fire in one pass of the timer IRQ. */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 5
+#define TIMER_MAX_TICKS ((1u << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+typedef struct Timer {
+    uint32_t expires; /* Tick it fires on */
+    uint32_t period;  /* Ticks between firings, 0 for a one-shot timer */
+    action1 function; /* Called from the timer IRQ, with interrupts off */
+    void *data;
+    struct Timer *next;
+    struct Timer **link; /* Whatever points at this timer in its slot, NULL while it isn't pending */
+} timer;
+
+uint32_t get_tick();
 void init_timer(uint32_t freq);
+uint64_t tick_cycles();
+
+void timer_init(timer *t, action1 function, void *data);
+void timer_start(timer *t, uint32_t ticks, uint32_t period);
+bool timer_cancel(timer *t);
+bool timer_pending(const timer *t);
+
+void sleep(uint32_t ticks);
 
-void wait(uint32_t ticks);
+/* Tickless mode, see timer.c */
+bool set_tickless(bool on);
+bool is_tickless();
+void timer_idle_enter();
+void timer_idle_exit();
 
 #endif
@@ -0,0 +1,22 @@
+#include "debugcon.h"
+#include "../cpu/ports.h"
+#include "../libc/string.h"
+
+void debug_write(const char *message, int length) {
+    for (int i = 0; i < length; i++)
+        port_byte_out(DEBUGCON_PORT, message[i]);
+}
+
+void debug_print(const char *message) {
+    debug_write(message, strlen(message));
+}
+
+void debug_print_uint(uint32_t value) {
+    char str[16];
+    uint_to_ascii(value, str);
+    debug_print(str);
+}
+
+void qemu_exit(uint8_t status) {
+    port_byte_out(DEBUG_EXIT_PORT, status);
+}
@@ -0,0 +1,19 @@
+#ifndef DEBUGCON_H_
+#define DEBUGCON_H_
+
+#include "../cpu/types.h"
+
+/* Bochs/QEMU debug console: every byte written to the port comes out on the host (qemu -debugcon) */
+#define DEBUGCON_PORT 0xE9
+
+void debug_write(const char *message, int length);
+void debug_print(const char *message);
+void debug_print_uint(uint32_t value);
+
+/* QEMU's isa-debug-exit device (-device isa-debug-exit,iobase=0xf4,iosize=0x04)
+ * QEMU quits with (status << 1) | 1, writing to the port does nothing without the device */
+#define DEBUG_EXIT_PORT 0xF4
+
+void qemu_exit(uint8_t status);
+
+#endif // DEBUGCON_H_
@@ -1,236 +1,463 @@
 #include "keyboard.h"
+#include "../cpu/info.h"
 #include "../cpu/isr.h"
 #include "../cpu/ports.h"
+#include "../kernel/scheduler.h"
 #include "../kernel/shell.h"
+#include "../libc/atomic.h"
 #include "../libc/function.h"
+#include "../libc/perfecthash.h"
 #include "../libc/string.h"
+#include "../libc/trace.h"
 #include "screen.h"
 
-#define SC_MAX 57
-const char *sc_name[] = {
-    "ERROR",
-    "Esc",
-    "1",
-    "2",
-    "3",
-    "4",
-    "5",
-    "6",
-    "7",
-    "8",
-    "9",
-    "0",
-    "-",
-    "=",
-    "Backspace",
-    "Tab",
-    "Q",
-    "W",
-    "E",
-    "R",
-    "T",
-    "Y",
-    "U",
-    "I",
-    "O",
-    "P",
-    "[",
-    "]",
-    "Enter",
-    "Lctrl",
-    "A",
-    "S",
-    "D",
-    "F",
-    "G",
-    "H",
-    "J",
-    "K",
-    "L",
-    ";",
-    "'",
-    "`",
-    "LShift",
-    "\\",
-    "Z",
-    "X",
-    "C",
-    "V",
-    "B",
-    "N",
-    "M",
-    ",",
-    ".",
-    "/",
-    "RShift",
-    "Keypad *",
-    "LAlt",
-    "Spacebar",
+enum KeyKind {
+    KIND_NONE,     /* Not a key we know about */
+    KIND_NAMED,    /* Has a name, but no character (function keys, arrows, ...) */
+    KIND_CHAR,     /* Shift picks the upper character */
+    KIND_LETTER,   /* Shift or caps lock picks the upper character, but not both */
+    KIND_KEYPAD,   /* Character with num lock on, otherwise acts as the navigation key in 'extra' */
+    KIND_MODIFIER, /* Held modifier, 'extra' is its MOD_ bit */
+    KIND_LOCK,     /* Toggled lock, 'extra' is its MOD_ bit */
 };
 
-const char sc_lower[] = {
-    '?',
-    '?',
-    '1',
-    '2',
-    '3',
-    '4',
-    '5',
-    '6',
-    '7',
-    '8',
-    '9',
-    '0',
-    '-',
-    '=',
-    '?',
-    '?',
-    'q',
-    'w',
-    'e',
-    'r',
-    't',
-    'y',
-    'u',
-    'i',
-    'o',
-    'p',
-    '[',
-    ']',
-    '?',
-    '?',
-    'a',
-    's',
-    'd',
-    'f',
-    'g',
-    'h',
-    'j',
-    'k',
-    'l',
-    ';',
-    '\'',
-    '`',
-    '?',
-    '\\',
-    'z',
-    'x',
-    'c',
-    'v',
-    'b',
-    'n',
-    'm',
-    ',',
-    '.',
-    '/',
-    '?',
-    '?',
-    '?',
-    ' ',
-};
+typedef struct KeyInfo {
+    const char *name;
+    char lower;
+    char upper;
+    uint8_t kind;
+    uint8_t extra;
+} key_info;
+
+#define NAMED(code, name) [code] = {name, 0, 0, KIND_NAMED, 0}
+#define CHAR(code, name, lower, upper) [code] = {name, lower, upper, KIND_CHAR, 0}
+#define LETTER(code, name, lower, upper) [code] = {name, lower, upper, KIND_LETTER, 0}
+#define KEYPAD(code, name, character, navigation) [code] = {name, character, character, KIND_KEYPAD, navigation}
+#define MODIFIER(code, name, modifier) [code] = {name, 0, 0, KIND_MODIFIER, modifier}
+#define LOCK(code, name, lock) [code] = {name, 0, 0, KIND_LOCK, lock}
+
+/* Scan code set 1, indexed by keycode. Anything not listed decodes as KIND_NONE */
+static const key_info keymap[256] = {
+    NAMED(KEY_ESCAPE, "Esc"),
+    CHAR(0x02, "1", '1', '!'),
+    CHAR(0x03, "2", '2', '@'),
+    CHAR(0x04, "3", '3', '#'),
+    CHAR(0x05, "4", '4', '$'),
+    CHAR(0x06, "5", '5', '%'),
+    CHAR(0x07, "6", '6', '^'),
+    CHAR(0x08, "7", '7', '&'),
+    CHAR(0x09, "8", '8', '*'),
+    CHAR(0x0A, "9", '9', '('),
+    CHAR(0x0B, "0", '0', ')'),
+    CHAR(0x0C, "-", '-', '_'),
+    CHAR(0x0D, "=", '=', '+'),
+    CHAR(KEY_BACKSPACE, "Backspace", '\b', '\b'),
+    CHAR(KEY_TAB, "Tab", '\t', '\t'),
+    LETTER(0x10, "Q", 'q', 'Q'),
+    LETTER(0x11, "W", 'w', 'W'),
+    LETTER(0x12, "E", 'e', 'E'),
+    LETTER(0x13, "R", 'r', 'R'),
+    LETTER(0x14, "T", 't', 'T'),
+    LETTER(0x15, "Y", 'y', 'Y'),
+    LETTER(0x16, "U", 'u', 'U'),
+    LETTER(0x17, "I", 'i', 'I'),
+    LETTER(0x18, "O", 'o', 'O'),
+    LETTER(0x19, "P", 'p', 'P'),
+    CHAR(0x1A, "[", '[', '{'),
+    CHAR(0x1B, "]", ']', '}'),
+    CHAR(KEY_ENTER, "Enter", '\n', '\n'),
+    MODIFIER(KEY_LCTRL, "LCtrl", MOD_CTRL),
+    LETTER(0x1E, "A", 'a', 'A'),
+    LETTER(0x1F, "S", 's', 'S'),
+    LETTER(0x20, "D", 'd', 'D'),
+    LETTER(0x21, "F", 'f', 'F'),
+    LETTER(0x22, "G", 'g', 'G'),
+    LETTER(0x23, "H", 'h', 'H'),
+    LETTER(0x24, "J", 'j', 'J'),
+    LETTER(0x25, "K", 'k', 'K'),
+    LETTER(0x26, "L", 'l', 'L'),
+    CHAR(0x27, ";", ';', ':'),
+    CHAR(0x28, "'", '\'', '"'),
+    CHAR(0x29, "`", '`', '~'),
+    MODIFIER(KEY_LSHIFT, "LShift", MOD_SHIFT),
+    CHAR(0x2B, "\\", '\\', '|'),
+    LETTER(0x2C, "Z", 'z', 'Z'),
+    LETTER(0x2D, "X", 'x', 'X'),
+    LETTER(0x2E, "C", 'c', 'C'),
+    LETTER(0x2F, "V", 'v', 'V'),
+    LETTER(0x30, "B", 'b', 'B'),
+    LETTER(0x31, "N", 'n', 'N'),
+    LETTER(0x32, "M", 'm', 'M'),
+    CHAR(0x33, ",", ',', '<'),
+    CHAR(0x34, ".", '.', '>'),
+    CHAR(0x35, "/", '/', '?'),
+    MODIFIER(KEY_RSHIFT, "RShift", MOD_SHIFT),
+    CHAR(0x37, "Keypad *", '*', '*'),
+    MODIFIER(KEY_LALT, "LAlt", MOD_ALT),
+    CHAR(KEY_SPACE, "Spacebar", ' ', ' '),
+    LOCK(KEY_CAPSLOCK, "CapsLock", MOD_CAPSLOCK),
+    NAMED(0x3B, "F1"),
+    NAMED(0x3C, "F2"),
+    NAMED(0x3D, "F3"),
+    NAMED(0x3E, "F4"),
+    NAMED(0x3F, "F5"),
+    NAMED(0x40, "F6"),
+    NAMED(0x41, "F7"),
+    NAMED(0x42, "F8"),
+    NAMED(0x43, "F9"),
+    NAMED(0x44, "F10"),
+    LOCK(KEY_NUMLOCK, "NumLock", MOD_NUMLOCK),
+    LOCK(KEY_SCROLLLOCK, "ScrollLock", MOD_SCROLLLOCK),
+    KEYPAD(0x47, "Keypad 7", '7', KEY_HOME),
+    KEYPAD(0x48, "Keypad 8", '8', KEY_UP),
+    KEYPAD(0x49, "Keypad 9", '9', KEY_PAGE_UP),
+    CHAR(0x4A, "Keypad -", '-', '-'),
+    KEYPAD(0x4B, "Keypad 4", '4', KEY_LEFT),
+    KEYPAD(0x4C, "Keypad 5", '5', 0),
+    KEYPAD(0x4D, "Keypad 6", '6', KEY_RIGHT),
+    CHAR(0x4E, "Keypad +", '+', '+'),
+    KEYPAD(0x4F, "Keypad 1", '1', KEY_END),
+    KEYPAD(0x50, "Keypad 2", '2', KEY_DOWN),
+    KEYPAD(0x51, "Keypad 3", '3', KEY_PAGE_DOWN),
+    KEYPAD(0x52, "Keypad 0", '0', KEY_INSERT),
+    KEYPAD(0x53, "Keypad .", '.', KEY_DELETE),
+    NAMED(KEY_F11, "F11"),
+    NAMED(KEY_F12, "F12"),
 
-const char sc_upper[] = {
-    '?',
-    '?',
-    '!',
-    '@',
-    '#',
-    '$',
-    '%',
-    '^',
-    '&',
-    '*',
-    '(',
-    ')',
-    '_',
-    '+',
-    '?',
-    '?',
-    'Q',
-    'W',
-    'E',
-    'R',
-    'T',
-    'Y',
-    'U',
-    'I',
-    'O',
-    'P',
-    '{',
-    '}',
-    '?',
-    '?',
-    'A',
-    'S',
-    'D',
-    'F',
-    'G',
-    'H',
-    'J',
-    'K',
-    'L',
-    ':',
-    '"',
-    '~',
-    '?',
-    '?',
-    'Z',
-    'X',
-    'C',
-    'V',
-    'B',
-    'N',
-    'M',
-    '<',
-    '>',
-    '|',
-    '?',
-    '?',
-    '?',
-    ' ',
+    CHAR(KEY_KEYPAD_ENTER, "Keypad Enter", '\n', '\n'),
+    MODIFIER(KEY_RCTRL, "RCtrl", MOD_CTRL),
+    CHAR(KEY_EXTENDED | 0x35, "Keypad /", '/', '/'),
+    NAMED(KEY_EXTENDED | 0x37, "PrintScreen"),
+    MODIFIER(KEY_RALT, "RAlt", MOD_ALT),
+    NAMED(KEY_PAUSE, "Pause"),
+    NAMED(KEY_HOME, "Home"),
+    NAMED(KEY_UP, "Up"),
+    NAMED(KEY_PAGE_UP, "PageUp"),
+    NAMED(KEY_LEFT, "Left"),
+    NAMED(KEY_RIGHT, "Right"),
+    NAMED(KEY_END, "End"),
+    NAMED(KEY_DOWN, "Down"),
+    NAMED(KEY_PAGE_DOWN, "PageDown"),
+    NAMED(KEY_INSERT, "Insert"),
+    NAMED(KEY_DELETE, "Delete"),
+    MODIFIER(KEY_LGUI, "LGui", MOD_GUI),
+    MODIFIER(KEY_RGUI, "RGui", MOD_GUI),
+    NAMED(KEY_EXTENDED | 0x5D, "Menu"),
 };
 
-const int get_scancode(const char *name) {
-    for (int i = 1; i < LEN(sc_name); i++) {
-        if (strcmp(sc_name[i], name))
+#undef NAMED
+#undef CHAR
+#undef LETTER
+#undef KEYPAD
+#undef MODIFIER
+#undef LOCK
+
+/* Key name -> keycode, hashed straight over the names in the keymap
+ * If the hash couldn't be built, names are looked for one by one instead */
+static perfect_hash key_names;
+static bool key_names_hashed = false;
+
+static int find_keycode(const char *name) {
+    if (key_names_hashed)
+        return phash_lookup(&key_names, name, strlen(name));
+
+    for (size_t i = 0; i < LEN(keymap); i++) {
+        if (keymap[i].name != NULL && strcmp(keymap[i].name, name) == 0)
             return i;
     }
-
-    kprintln("ERROR: get_scancode on invalid scancode name");
-    asm volatile("hlt");
     return -1;
 }
 
-char get_letter(int scancode, bool upper) {
-    return (upper ? sc_upper : sc_lower)[scancode];
+int get_keycode(const char *name) {
+    int keycode = find_keycode(name);
+
+    if (keycode < 0)
+        kprintln("ERROR: get_keycode on invalid key name");
+
+    return keycode;
+}
+
+const char *get_key_name(uint8_t keycode) {
+    return keymap[keycode].name;
 }
 
-static void empty_handler(uint8_t scancode){};
+/**
+ * Finds the key (and whether shift is needed) that types the given character
+ * Returns false if no key on the main block produces it
+ */
+bool get_key_for_char(char c, uint8_t *keycode, bool *shift) {
+    for (int i = 0; i < KEY_EXTENDED; i++) {
+        const key_info *info = &keymap[i];
+        if (info->kind != KIND_CHAR && info->kind != KIND_LETTER)
+            continue;
+
+        if (info->lower == c || info->upper == c) {
+            *keycode = i;
+            *shift = info->lower != c;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**********************************************************
+ * Decoder                                                *
+ **********************************************************/
+
+#define PREFIX_EXTENDED 0xE0
+#define PREFIX_PAUSE 0xE1
+
+static bool extended = false;
+static uint8_t pause_remaining = 0; /* Bytes of the E1 (Pause) sequence still to come */
+static uint32_t keys_down[256 / 32];
+static uint8_t modifiers = 0; /* Held modifiers and toggled locks */
 
-keyhandler key_handler = &empty_handler;
+static const uint8_t modifier_keys[] = {KEY_LSHIFT, KEY_RSHIFT, KEY_LCTRL, KEY_RCTRL, KEY_LALT, KEY_RALT, KEY_LGUI,
+    KEY_RGUI};
+
+#define IS_DOWN(keycode) BIT(keys_down[(keycode) / 32], (keycode) % 32)
+
+/**
+ * Feeds one byte from the controller into the decoder
+ * Returns true and fills in 'event' once a full key press or release has been seen
+ */
+static bool decode(uint8_t scancode, key_event *event) {
+    uint8_t keycode;
+
+    if (pause_remaining > 0) {
+        /* Pause sends E1 1D 45 on press and E1 9D C5 on release, we only look at the last byte */
+        if (--pause_remaining > 0)
+            return false;
+        keycode = KEY_PAUSE;
+    } else {
+        switch (scancode) {
+            case PREFIX_EXTENDED:
+                extended = true;
+                return false;
+            case PREFIX_PAUSE:
+                pause_remaining = 2;
+                return false;
+            case 0x00: /* Key detection error */
+            case 0xFA: /* Command acknowledged */
+            case 0xFE: /* Resend request */
+            case 0xFF: /* Key detection error */
+                return false;
+        }
+
+        keycode = (scancode & ~SCANCODE_BREAK) | (extended ? KEY_EXTENDED : 0);
+        extended = false;
+
+        /* Extended keys get wrapped in fake shift presses and releases on some layouts, drop them */
+        if (keycode == (KEY_EXTENDED | KEY_LSHIFT) || keycode == (KEY_EXTENDED | KEY_RSHIFT))
+            return false;
+    }
+
+    bool released = scancode & SCANCODE_BREAK;
+    const key_info *info = &keymap[keycode];
+
+    event->flags = 0;
+    if (released) {
+        keys_down[keycode / 32] &= ~(1 << (keycode % 32));
+        event->flags |= KEY_RELEASED;
+    } else {
+        if (IS_DOWN(keycode))
+            event->flags |= KEY_REPEAT;
+        keys_down[keycode / 32] |= 1 << (keycode % 32);
+    }
+
+    if (info->kind == KIND_MODIFIER) {
+        modifiers &= ~(MOD_SHIFT | MOD_CTRL | MOD_ALT | MOD_GUI);
+        for (size_t i = 0; i < LEN(modifier_keys); i++) {
+            if (IS_DOWN(modifier_keys[i]))
+                modifiers |= keymap[modifier_keys[i]].extra;
+        }
+    } else if (info->kind == KIND_LOCK && event->flags == 0)
+        modifiers ^= info->extra;
+
+    /* With num lock off the keypad doubles as the navigation cluster */
+    if (info->kind == KIND_KEYPAD && !(modifiers & MOD_NUMLOCK)) {
+        keycode = info->extra;
+        info = &keymap[keycode];
+    }
+
+    char ascii = 0;
+    bool shift = modifiers & MOD_SHIFT;
+    switch (info->kind) {
+        case KIND_CHAR:
+            ascii = shift ? info->upper : info->lower;
+            break;
+        case KIND_LETTER:
+            ascii = shift != (bool)(modifiers & MOD_CAPSLOCK) ? info->upper : info->lower;
+            if (modifiers & MOD_CTRL)
+                ascii &= 0x1F;
+            break;
+        case KIND_KEYPAD:
+            ascii = info->lower;
+            break;
+    }
+
+    event->keycode = keycode;
+    event->modifiers = modifiers;
+    event->ascii = ascii;
+    return true;
+}
+
+static void empty_handler(key_event event) {
+    UNUSED(event);
+}
+
+/* Swapped by whatever wants the keys, while the bottom half may be reading it */
+static atomic_ptr key_handler = ATOMIC_INIT((void *)&empty_handler);
 
 keyhandler swap_key_handler(keyhandler new_handler) {
-    keyhandler current = key_handler;
-    key_handler = new_handler;
-    return current;
+    return (keyhandler)atomic_exchange_ptr(&key_handler, (void *)new_handler);
 }
 
 void return_key_handler(keyhandler new_handler) {
-    key_handler = new_handler;
+    atomic_store_ptr(&key_handler, (void *)new_handler);
+}
+
+#define KEYBOARD_DATA 0x60
+#define KEYBOARD_STATUS 0x64
+#define KEYBOARD_OUTPUT_FULL 0x01
+
+/* Single-producer (IRQ) single-consumer (bottom half) ring of raw scancodes
+ * The indices only ever increase, so head - tail is the fill level even across wraps */
+#define SCANCODE_RING_SIZE 64 // Must be a power of two
+typedef struct RingEntry {
+    uint8_t scancode;
+    uint32_t timestamp;
+} ring_entry;
+
+static volatile ring_entry scancode_ring[SCANCODE_RING_SIZE];
+static volatile uint32_t ring_head = 0; /* Only written by the IRQ */
+static volatile uint32_t ring_tail = 0; /* Only written by the bottom half */
+
+static keyboard_stats stats;
+static int bottom_half_id;
+
+keyboard_stats get_keyboard_stats() {
+    return stats;
+}
+
+/**
+ * Queues a scancode for the bottom half
+ * Returns false (and counts an overflow) if the ring is full
+ * Must run with interrupts disabled, the IRQ is the other producer
+ */
+static bool push_scancode(uint8_t scancode, uint32_t timestamp) {
+    if (ring_head - ring_tail == SCANCODE_RING_SIZE) {
+        stats.overflows++;
+        return false;
+    }
+
+    scancode_ring[ring_head % SCANCODE_RING_SIZE].scancode = scancode;
+    scancode_ring[ring_head % SCANCODE_RING_SIZE].timestamp = timestamp;
+    ring_head++;
+    stats.scancodes++;
+    return true;
+}
+
+static scancode_recorder recorder = NULL;
+
+/**
+ * Installs a function that gets every scancode read from the controller, straight from the IRQ
+ * Pass NULL to remove it
+ */
+void register_scancode_recorder(scancode_recorder new_recorder) {
+    recorder = new_recorder;
 }
 
+/**
+ * Top half: drain the controller into the ring and get out
+ */
 static void keyboard_callback(registers_t regs) {
     UNUSED(regs);
+    uint64_t start = rdtsc();
 
-    /* The PIC leaves us the scancode in port 0x60 */
-    uint8_t scancode = port_byte_in(0x60);
+    /* The controller can have several bytes queued (e.g. multi-byte scancodes),
+     * so keep reading until it reports the output buffer as empty */
+    while (port_byte_in(KEYBOARD_STATUS) & KEYBOARD_OUTPUT_FULL) {
+        uint8_t scancode = port_byte_in(KEYBOARD_DATA);
 
-    if (scancode > SC_MAX)
-        return;
+        if (recorder != NULL)
+            (*recorder)(scancode);
+
+        push_scancode(scancode, rdtsc());
+    }
+
+    raise_bottom_half(bottom_half_id);
 
-    (*key_handler)(scancode);
+    uint32_t cycles = rdtsc() - start;
+    stats.irqs++;
+    stats.irq_cycles += cycles;
+    if (cycles > stats.max_irq_cycles)
+        stats.max_irq_cycles = cycles;
+}
+
+/**
+ * Feeds a scancode in exactly as if the keyboard IRQ had read it from the controller
+ * Returns false if the ring is full, the caller should let the bottom half drain it and retry
+ */
+bool inject_scancode(uint8_t scancode) {
+    uint32_t flags = irq_save();
+
+    /* Don't count a full ring as an overflow, injectors back off and retry */
+    bool queued = ring_head - ring_tail != SCANCODE_RING_SIZE && push_scancode(scancode, rdtsc());
+
+    irq_restore(flags);
+
+    if (queued)
+        raise_bottom_half(bottom_half_id);
+    return queued;
+}
+
+static bool paused = false;
+
+/**
+ * Stops key events being dispatched, scancodes keep queueing in the ring
+ * Lets a consumer finish with one line before it's handed the keys typed after it
+ */
+void pause_key_events() {
+    paused = true;
+}
+
+void resume_key_events() {
+    paused = false;
+    raise_bottom_half(bottom_half_id);
+}
+
+/**
+ * Bottom half: decode and dispatch everything the IRQ has queued up
+ * Whatever the key handler schedules is boosted, it's what the user is waiting on
+ */
+static void keyboard_bottom_half() {
+    bool was_interactive = set_interactive(true);
+    while (!paused && ring_tail != ring_head) {
+        uint8_t scancode = scancode_ring[ring_tail % SCANCODE_RING_SIZE].scancode;
+        uint32_t timestamp = scancode_ring[ring_tail % SCANCODE_RING_SIZE].timestamp;
+        ring_tail++;
+
+        key_event event;
+        if (decode(scancode, &event)) {
+            event.timestamp = timestamp;
+            TRACE(TRACE_KEY, event.keycode, event.flags);
+            (*(keyhandler)atomic_load_ptr(&key_handler))(event);
+        }
+    }
+    set_interactive(was_interactive);
 }
 
 void init_keyboard() {
+    key_names_hashed = phash_build(&key_names, &keymap[0].name, sizeof(key_info), LEN(keymap));
+    if (!key_names_hashed)
+        kprintln("ERROR: couldn't hash the key names, looking them up one by one");
+
+    bottom_half_id = register_bottom_half(keyboard_bottom_half);
+    if (bottom_half_id < 0) {
+        kprintln("ERROR: no bottom half left for the keyboard, keys won't be read");
+        return;
+    }
     register_interrupt_handler(IRQ1, keyboard_callback);
 }
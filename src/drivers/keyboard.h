@@ -2,20 +2,95 @@
 #define KEYBOARD_H
 #include "../cpu/types.h"
 
-#define BACKSPACE 14
-#define ENTER 28
-#define LSHIFT 42
-#define RSHIFT 54
+/* Keycodes are scan code set 1 make codes, with the high bit set for keys sent behind an 0xE0 prefix */
+#define KEY_EXTENDED 0x80
 
-typedef void (*keyhandler)(uint8_t);
+#define KEY_ESCAPE 0x01
+#define KEY_BACKSPACE 0x0E
+#define KEY_TAB 0x0F
+#define KEY_Q 0x10
+#define KEY_ENTER 0x1C
+#define KEY_LCTRL 0x1D
+#define KEY_LSHIFT 0x2A
+#define KEY_RSHIFT 0x36
+#define KEY_LALT 0x38
+#define KEY_SPACE 0x39
+#define KEY_CAPSLOCK 0x3A
+#define KEY_F1 0x3B
+#define KEY_F10 0x44
+#define KEY_NUMLOCK 0x45
+#define KEY_SCROLLLOCK 0x46
+#define KEY_F11 0x57
+#define KEY_F12 0x58
 
-extern keyhandler key_handler;
+#define KEY_KEYPAD_ENTER (KEY_EXTENDED | 0x1C)
+#define KEY_RCTRL (KEY_EXTENDED | 0x1D)
+#define KEY_RALT (KEY_EXTENDED | 0x38)
+#define KEY_PAUSE (KEY_EXTENDED | 0x45)
+#define KEY_HOME (KEY_EXTENDED | 0x47)
+#define KEY_UP (KEY_EXTENDED | 0x48)
+#define KEY_PAGE_UP (KEY_EXTENDED | 0x49)
+#define KEY_LEFT (KEY_EXTENDED | 0x4B)
+#define KEY_RIGHT (KEY_EXTENDED | 0x4D)
+#define KEY_END (KEY_EXTENDED | 0x4F)
+#define KEY_DOWN (KEY_EXTENDED | 0x50)
+#define KEY_PAGE_DOWN (KEY_EXTENDED | 0x51)
+#define KEY_INSERT (KEY_EXTENDED | 0x52)
+#define KEY_DELETE (KEY_EXTENDED | 0x53)
+#define KEY_LGUI (KEY_EXTENDED | 0x5B)
+#define KEY_RGUI (KEY_EXTENDED | 0x5C)
+
+/* Key event flags */
+#define KEY_RELEASED 0x01
+#define KEY_REPEAT 0x02
+
+/* Modifier and lock state, as it was when the event was decoded */
+#define MOD_SHIFT 0x01
+#define MOD_CTRL 0x02
+#define MOD_ALT 0x04
+#define MOD_GUI 0x08
+#define MOD_CAPSLOCK 0x10
+#define MOD_NUMLOCK 0x20
+#define MOD_SCROLLLOCK 0x40
+
+typedef struct KeyEvent {
+    uint8_t keycode;
+    uint8_t flags;
+    uint8_t modifiers;
+    char ascii; /* Printable (or control) character for the key, 0 if it has none */
+    uint32_t timestamp; /* Low half of the TSC when the IRQ read the key's last byte */
+} key_event;
+
+#define KEY_PRESSED(event) (!((event).flags & KEY_RELEASED))
+
+typedef void (*keyhandler)(key_event);
 
 keyhandler swap_key_handler(keyhandler new_handler);
 void return_key_handler(keyhandler new_handler);
 
-const int get_scancode(const char *name);
-char get_letter(int scancode, bool upper);
+int get_keycode(const char *name);
+const char *get_key_name(uint8_t keycode);
+bool get_key_for_char(char c, uint8_t *keycode, bool *shift);
+
+/* Break (release) codes are the make code with the high bit set */
+#define SCANCODE_BREAK 0x80
+
+typedef void (*scancode_recorder)(uint8_t);
+void register_scancode_recorder(scancode_recorder recorder);
+bool inject_scancode(uint8_t scancode);
+
+void pause_key_events();
+void resume_key_events();
+
+typedef struct KeyboardStats {
+    uint32_t irqs;
+    uint32_t scancodes;
+    uint32_t overflows; /* Scancodes dropped because the ring was full */
+    uint64_t irq_cycles; /* Total cycles spent in the top half */
+    uint32_t max_irq_cycles;
+} keyboard_stats;
+
+keyboard_stats get_keyboard_stats();
 
 void init_keyboard();
 
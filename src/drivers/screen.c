@@ -19,12 +19,37 @@ int get_offset_col(int offset);
  * Public Kernel API functions                            *
  **********************************************************/
 
+static output_sink sink = NULL;
+
+/**
+ * Sends everything printed at the cursor to 'new_sink' instead of the screen, NULL goes back to the screen
+ * Printing at a given position still goes to the screen, it only makes sense there
+ * Returns the sink that was in place, to hand back to return_output_sink
+ */
+output_sink swap_output_sink(output_sink new_sink) {
+    output_sink current = sink;
+    sink = new_sink;
+    return current;
+}
+
+void return_output_sink(output_sink old_sink) {
+    sink = old_sink;
+}
+
 /**
  * Print a message on the specified location
  * If col, row, are negative, we will use the current offset
  * Print until the given sentinel value.
  */
 void kprint_at_until(const char *message, char sentinel, int col, int row) {
+    if (col < 0 && row < 0 && sink != NULL) {
+        int length = 0;
+        while (message[length] != sentinel)
+            length++;
+        (*sink)(message, length);
+        return;
+    }
+
     /* Set cursor if col/row are negative */
     int offset;
     if (col >= 0 && row >= 0)
@@ -89,6 +114,20 @@ void kprintln_until(const char *message, char sentinel) {
     kprint("\n");
 }
 
+/**
+ * Prints a slice at the current offset, it doesn't need to be null terminated
+ */
+void kprint_slice(slice text) {
+    if (sink != NULL) {
+        (*sink)(text.start, text.length);
+        return;
+    }
+
+    int offset = get_cursor_offset();
+    for (int i = 0; i < text.length; i++)
+        offset = print_char(text.start[i], get_offset_col(offset), get_offset_row(offset), WHITE_ON_BLACK);
+}
+
 /**
  * Prints a message, formatting in variable values based on the given format string
  * Variable values must be character arrays/strings
@@ -359,15 +398,7 @@ int print_char(char c, int col, int row, char attr) {
 
     /* Check if the offset is over screen size and scroll */
     if (offset >= SCREEN_SIZE_BYTES) {
-        int i;
-        for (i = 1; i < MAX_ROWS; i++)
-            memory_copy(video_memory + get_offset(0, i), video_memory + get_offset(0, i - 1), MAX_COLS * 2);
-
-        /* Blank last line */
-        char *last_line = (char *)(video_memory + get_offset(0, MAX_ROWS - 1));
-        for (i = 0; i < MAX_COLS * 2; i++)
-            last_line[i] = 0;
-
+        scroll_screen();
         offset -= 2 * MAX_COLS;
     }
 
@@ -375,6 +406,21 @@ int print_char(char c, int col, int row, char attr) {
     return offset;
 }
 
+/**
+ * Moves everything on screen up a line, leaving the last line blank
+ * Doesn't touch the cursor
+ */
+void scroll_screen() {
+    int i;
+    for (i = 1; i < MAX_ROWS; i++)
+        memory_copy(video_memory + get_offset(0, i), video_memory + get_offset(0, i - 1), MAX_COLS * 2);
+
+    /* Blank last line */
+    char *last_line = (char *)(video_memory + get_offset(0, MAX_ROWS - 1));
+    for (i = 0; i < MAX_COLS * 2; i++)
+        last_line[i] = 0;
+}
+
 int get_cursor_offset() {
     /* Use the VGA ports to get the current cursor position
      * 1. Ask for high byte of the cursor offset (data 14)
@@ -19,6 +19,10 @@
 #define REG_SCREEN_DATA 0x3d5
 
 /* Public kernel API */
+typedef void (*output_sink)(const char *message, int length);
+output_sink swap_output_sink(output_sink new_sink);
+void return_output_sink(output_sink old_sink);
+
 void clear_screen();
 void kprint_at_until(const char *message, char sentinel, int col, int row);
 void kprint_at(const char *message, int col, int row);
@@ -26,11 +30,13 @@ void kprint(const char *message);
 void kprintln(const char *message);
 void kprint_until(const char *message, char sentinel);
 void kprintln_until(const char *message, char sentinel);
+void kprint_slice(slice text);
 void kprintf(const char *format, ...);
 void kprintlnf(const char *format, ...);
 void kprint_backspace();
 void paint(char c, char attr, int col, int row);
 void paint_rect(char c, char attr, int origin_col, int origin_row, int width, int height, bool fill);
+void scroll_screen();
 void copy_screen_to(uint8_t *address);
 void copy_screen_from(uint8_t *address);
 int get_cursor_offset();
@@ -0,0 +1,70 @@
+#include "batch.h"
+#include "../drivers/debugcon.h"
+#include "../drivers/screen.h"
+#include "../libc/mem.h"
+#include "../libc/string.h"
+#include "lineedit.h"
+#include "scheduler.h"
+#include "shell.h"
+#include "thread.h"
+
+static char script[BOOT_SCRIPT_SIZE];
+static char *next_line = NULL;
+static bool failed = false;
+
+/**
+ * Copies the boot script out of where the boot sector left it
+ * Has to happen before anything is allocated, the heap starts below it
+ * From then on everything printed goes to the debug port, headless nobody sees the screen
+ * Returns false if there isn't one
+ */
+bool load_boot_script() {
+    const char *loaded = (const char *)BOOT_SCRIPT_ADDRESS;
+    int magic = strlen(BOOT_SCRIPT_MAGIC);
+    if (strncmp(loaded, BOOT_SCRIPT_MAGIC, magic) != 0)
+        return false;
+
+    memory_copy((uint8_t *)&loaded[magic], (uint8_t *)script, BOOT_SCRIPT_SIZE - magic);
+    script[BOOT_SCRIPT_SIZE - magic] = '\0';
+    next_line = script;
+
+    swap_output_sink(&debug_write);
+    return true;
+}
+
+/**
+ * Runs the next line of the script, then reschedules itself behind anything that line scheduled
+ * Once the script is done and nothing else is queued or running, exits QEMU with 1 if any line failed
+ */
+void run_boot_script() {
+    if (*next_line == '\0') {
+        if (get_scheduler_stats().queued > 0 || thread_count() > 1) {
+            schedule(&run_boot_script);
+            return;
+        }
+
+        kprintln(failed ? "Batch failed" : "Batch done");
+        qemu_exit(failed);
+        stop();
+        return;
+    }
+
+    char *line = next_line;
+    while (*next_line != '\n' && *next_line != '\0')
+        next_line++;
+    if (*next_line == '\n')
+        *next_line++ = '\0';
+
+    if (line[0] == '\0' || line[0] == '#') {
+        /* Blank lines and comments */
+    } else if (strlen(line) >= LINE_MAX) {
+        kprintln("Line too long");
+        failed = true;
+    } else {
+        kprintlnf("{}{}", PROMPT, line);
+        if (!run_line(line))
+            failed = true;
+    }
+
+    schedule(&run_boot_script);
+}
@@ -0,0 +1,18 @@
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include "../cpu/types.h"
+
+/* Headless runs
+ *
+ * The boot sector loads KERNEL_SECTORS whether the kernel needs them or not, and the last 8 are kept
+ * for a script (nix run .#batch writes it into the image). If one is there, it's run line by line
+ * through the shell with the output going to the debug port, then QEMU is told to exit. */
+#define BOOT_SCRIPT_ADDRESS (0x8000 + (320 - 8) * 512) // Kernel and BSS have to stay below this, the link checks
+#define BOOT_SCRIPT_SIZE (8 * 512)
+#define BOOT_SCRIPT_MAGIC "#!xenia\n"
+
+bool load_boot_script();
+void run_boot_script();
+
+#endif // BATCH_H_
@@ -0,0 +1,239 @@
+#include "bench.h"
+#include "../cpu/clock.h"
+#include "../drivers/debugcon.h"
+#include "../drivers/screen.h"
+#include "../libc/mem.h"
+#include "../libc/sort.h"
+#include "../libc/string.h"
+#include "shell.h"
+
+#define BENCH(name) static void bench_##name()
+#define BENCHREF(name, setup, teardown) \
+    { #name, setup, bench_##name, teardown }
+
+/////////// Memory //////////
+
+/* For teardowns that also clean up after a setup that only got part of what it asked for */
+static void free_allocated(void *address) {
+    if (address != NULL)
+        kfree((size_t)address);
+}
+
+#define COPY_SIZE 4096
+static uint8_t *source, *destination;
+
+static void teardown_buffers() {
+    free_allocated(source);
+    free_allocated(destination);
+}
+
+static bool setup_buffers() {
+    source = (uint8_t *)kmalloc(COPY_SIZE);
+    destination = (uint8_t *)kmalloc(COPY_SIZE);
+    if (source == NULL || destination == NULL) {
+        teardown_buffers();
+        return false;
+    }
+
+    memory_set(source, 0xA5, COPY_SIZE);
+    return true;
+}
+
+BENCH(memory_copy_4k) {
+    memory_copy(source, destination, COPY_SIZE);
+}
+
+BENCH(memory_set_4k) {
+    memory_set(destination, 0, COPY_SIZE);
+}
+
+BENCH(kmalloc_kfree_64) {
+    kfree(kmalloc(64));
+}
+
+BENCH(kmalloc_kfree_4k) {
+    kfree(kmalloc(4096));
+}
+
+/////////// Screen //////////
+
+/* Benchmarks that draw put the screen back afterwards */
+static screenstate *saved_screen;
+
+static bool save_screen() {
+    saved_screen = (screenstate *)kmalloc(sizeof(screenstate));
+    if (saved_screen == NULL)
+        return false;
+
+    save_screen_to(saved_screen);
+    return true;
+}
+
+static void restore_screen() {
+    load_screen_from(saved_screen);
+    kfree((size_t)saved_screen);
+}
+
+BENCH(kprint_line) {
+    kprint_at("The quick brown fox jumps over the lazy dog, then does it again.", 0, 0);
+}
+
+BENCH(paint_rect_screen) {
+    paint_rect(' ', 0x10, 0, 0, MAX_COLS, MAX_ROWS, true);
+}
+
+/////////// Sorting //////////
+
+/* Each run sorts a fresh copy of the same shuffled array, so the copy is part of the time */
+#define SORT_LENGTH 256
+static uint32_t *unsorted, *work, *scratch;
+
+static void teardown_sort() {
+    free_allocated(unsorted);
+    free_allocated(work);
+    free_allocated(scratch);
+}
+
+static bool setup_sort() {
+    unsorted = (uint32_t *)kmalloc(SORT_LENGTH * sizeof(uint32_t));
+    work = (uint32_t *)kmalloc(SORT_LENGTH * sizeof(uint32_t));
+    scratch = (uint32_t *)kmalloc(SORT_LENGTH * sizeof(uint32_t));
+    if (unsorted == NULL || work == NULL || scratch == NULL) {
+        teardown_sort();
+        return false;
+    }
+
+    /* Fixed seed, so every build sorts the same array */
+    uint32_t state = 12345;
+    for (int i = 0; i < SORT_LENGTH; i++) {
+        state = state * 1103515245 + 12345;
+        unsorted[i] = state >> 16;
+    }
+    return true;
+}
+
+#define FRESH_COPY() memory_copy((uint8_t *)unsorted, (uint8_t *)work, SORT_LENGTH * sizeof(uint32_t))
+
+BENCH(insertion_sort_256) {
+    FRESH_COPY();
+    insertion_sort(work, SORT_LENGTH);
+}
+
+BENCH(quick_sort_256) {
+    FRESH_COPY();
+    quick_sort(work, SORT_LENGTH);
+}
+
+BENCH(merge_sort_256) {
+    FRESH_COPY();
+    merge_sort(work, scratch, SORT_LENGTH);
+}
+
+const benchmark benchmarks[] = {
+    BENCHREF(memory_copy_4k, setup_buffers, teardown_buffers),
+    BENCHREF(memory_set_4k, setup_buffers, teardown_buffers),
+    BENCHREF(kmalloc_kfree_64, NULL, NULL),
+    BENCHREF(kmalloc_kfree_4k, NULL, NULL),
+    BENCHREF(kprint_line, save_screen, restore_screen),
+    BENCHREF(paint_rect_screen, save_screen, restore_screen),
+    BENCHREF(insertion_sort_256, setup_sort, teardown_sort),
+    BENCHREF(quick_sort_256, setup_sort, teardown_sort),
+    BENCHREF(merge_sort_256, setup_sort, teardown_sort),
+};
+
+/////////// Runner //////////
+
+static uint32_t samples[BENCH_SAMPLES];
+
+static void empty_run() {
+}
+
+/**
+ * Times BENCH_SAMPLES runs after BENCH_WARMUP untimed ones, leaving them sorted in 'samples'
+ */
+static void sample(action0 run, uint32_t overhead) {
+    for (int i = 0; i < BENCH_WARMUP; i++)
+        (*run)();
+
+    for (int i = 0; i < BENCH_SAMPLES; i++) {
+        uint32_t start = clock_cycles();
+        (*run)();
+        uint32_t cycles = (uint32_t)clock_cycles() - start;
+        samples[i] = cycles > overhead ? cycles - overhead : 0;
+    }
+
+    quick_sort(samples, BENCH_SAMPLES);
+}
+
+/* What timing a run costs by itself, the fastest empty run */
+static uint32_t timing_overhead() {
+    sample(&empty_run, 0);
+    return samples[0];
+}
+
+/**
+ * Returns false, having timed nothing, if the benchmark couldn't be set up
+ */
+bool run_benchmark(const benchmark *bench, bench_result *result) {
+    uint32_t overhead = timing_overhead();
+
+    if (bench->setup != NULL && !(*bench->setup)())
+        return false;
+
+    sample(bench->run, overhead);
+
+    if (bench->teardown != NULL)
+        (*bench->teardown)();
+
+    result->min = samples[0];
+    result->median = samples[BENCH_SAMPLES / 2];
+    result->p99 = samples[BENCH_SAMPLES * 99 / 100];
+    return true;
+}
+
+static void report_json(const benchmark *bench, bench_result result) {
+    debug_print("{\"bench\":\"");
+    debug_print(bench->name);
+    debug_print("\",\"samples\":");
+    debug_print_uint(BENCH_SAMPLES);
+    debug_print(",\"min\":");
+    debug_print_uint(result.min);
+    debug_print(",\"median\":");
+    debug_print_uint(result.median);
+    debug_print(",\"p99\":");
+    debug_print_uint(result.p99);
+    debug_print(",\"median_ns\":");
+    debug_print_uint((uint32_t)cycles_to_ns(result.median));
+    debug_print(",\"unit\":\"cycles\"}\n");
+}
+
+/**
+ * Runs every benchmark with 'pattern' in its name, all of them for an empty pattern
+ * Returns how many ran
+ */
+int run_benchmarks(const char *pattern) {
+    slice part = {pattern, strlen(pattern)};
+    int ran = 0;
+
+    for (size_t i = 0; i < LEN(benchmarks); i++) {
+        const benchmark *bench = &benchmarks[i];
+        slice name = {bench->name, strlen(bench->name)};
+        if (!slice_contains(name, part))
+            continue;
+
+        if (ran++ == 0)
+            kprintlnf("Benchmark: min / median / p99 cycles, TSC at {u} kHz", clock_khz());
+
+        bench_result result;
+        if (!run_benchmark(bench, &result)) {
+            kprintlnf("{}: skipped, not enough memory to set it up", bench->name);
+            continue;
+        }
+
+        kprintlnf("{}: {u} / {u} / {u}, {u} ns median", bench->name, result.min, result.median, result.p99,
+            (uint32_t)cycles_to_ns(result.median));
+        report_json(bench, result);
+    }
+
+    return ran;
+}
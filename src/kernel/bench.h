@@ -0,0 +1,34 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include "../cpu/types.h"
+#include "../libc/function.h"
+
+/* Microbenchmarks, timed with the TSC
+ *
+ * setup and teardown run once around the whole benchmark and aren't timed, run is one timed iteration.
+ * Every benchmark gets warmed up, then sampled, and reported as min/median/p99 cycles with the cost of
+ * timing an empty run taken off. Results also go out of the debug port as JSON lines. */
+#define BENCH_WARMUP 16
+#define BENCH_SAMPLES 256
+
+/* Returns false if it couldn't set up, having given back anything it did get */
+typedef bool (*bench_setup)();
+
+typedef struct Benchmark {
+    const char *name;
+    bench_setup setup; /* May be NULL */
+    action0 run;
+    action0 teardown; /* May be NULL */
+} benchmark;
+
+typedef struct BenchResult {
+    uint32_t min;
+    uint32_t median;
+    uint32_t p99;
+} bench_result;
+
+bool run_benchmark(const benchmark *bench, bench_result *result);
+int run_benchmarks(const char *pattern);
+
+#endif // BENCH_H_
@@ -0,0 +1,88 @@
+#include "coroutine.h"
+#include "../drivers/screen.h"
+#include "thread.h"
+
+static coroutine *coroutines[MAX_COROUTINES];
+static int coroutine_count = 0;
+
+/**
+ * Adds a coroutine to be stepped from the scheduler loop, starting at the top
+ * Returns false if it's already running or there's no room
+ */
+bool co_start(coroutine *co, const char *name, coroutine_step step, size_t state_size) {
+    if (coroutine_count == MAX_COROUTINES)
+        return false;
+    for (int i = 0; i < coroutine_count; i++) {
+        if (coroutines[i] == co)
+            return false;
+    }
+
+    co->name = name;
+    co->step = step;
+    co->line = 0;
+    co->wake_tick = get_tick();
+    co->state_size = state_size;
+    coroutines[coroutine_count++] = co;
+    return true;
+}
+
+static bool is_due(const coroutine *co) {
+    return (int32_t)(get_tick() - co->wake_tick) >= 0;
+}
+
+/**
+ * Steps every coroutine that's due once, dropping the ones that finish
+ * Returns whether any ran
+ */
+bool run_coroutines() {
+    bool ran = false;
+
+    for (int i = 0; i < coroutine_count;) {
+        coroutine *co = coroutines[i];
+        if (!is_due(co)) {
+            i++;
+            continue;
+        }
+
+        ran = true;
+        if ((*co->step)(co))
+            coroutines[i] = coroutines[--coroutine_count];
+        else
+            i++;
+    }
+
+    return ran;
+}
+
+bool coroutines_ready() {
+    for (int i = 0; i < coroutine_count; i++) {
+        if (is_due(coroutines[i]))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Finds the earliest tick a coroutine is waiting for, for the tickless timer
+ * Returns false if none are waiting
+ */
+bool next_coroutine_wake(uint32_t *wake_tick) {
+    bool found = false;
+    for (int i = 0; i < coroutine_count; i++) {
+        if (!found || (int32_t)(coroutines[i]->wake_tick - *wake_tick) < 0)
+            *wake_tick = coroutines[i]->wake_tick;
+        found = true;
+    }
+    return found;
+}
+
+void print_coroutines() {
+    for (int i = 0; i < coroutine_count; i++) {
+        const coroutine *co = coroutines[i];
+        kprintlnf("{}: {u} bytes ({u} for the coroutine, {u} of state)", co->name, sizeof(coroutine) + co->state_size,
+            sizeof(coroutine), co->state_size);
+    }
+
+    kprintlnf("A thread takes {u} bytes ({u} for the thread, {u} of stack)", sizeof(thread) + THREAD_STACK_SIZE,
+        sizeof(thread), THREAD_STACK_SIZE);
+}
@@ -0,0 +1,62 @@
+#ifndef COROUTINE_H_
+#define COROUTINE_H_
+
+#include "../cpu/timer.h"
+#include "../cpu/types.h"
+
+/* Stackless coroutines, stepped from the scheduler loop
+ *
+ * A coroutine is a function that gets called over and over, and picks up where it left off using a switch
+ * on the line it last yielded from (Duff's device, as in protothreads). Nothing on its stack survives a
+ * yield, so anything that has to goes in a static or in state it's handed, and it can't yield from inside
+ * its own switch statements. In exchange it costs a few bytes instead of a whole stack. */
+#define MAX_COROUTINES 8
+
+typedef struct Coroutine coroutine;
+typedef bool (*coroutine_step)(coroutine *co); /* Returns true once finished */
+
+struct Coroutine {
+    const char *name;
+    coroutine_step step;
+    int line;           /* Where to resume, 0 to start from the top */
+    uint32_t wake_tick; /* Not stepped again before this */
+    size_t state_size;  /* What it keeps between steps, for reporting */
+};
+
+#define CO_BEGIN(co)      \
+    switch ((co)->line) { \
+        case 0:
+
+#define CO_YIELD(co)           \
+    do {                       \
+        (co)->line = __LINE__; \
+        return false;          \
+        case __LINE__:;        \
+    } while (0)
+
+/* Yields, and isn't stepped again until 'ticks' have passed */
+#define CO_WAIT(co, ticks)                          \
+    do {                                            \
+        (co)->wake_tick = get_tick() + (ticks) + 1; \
+        CO_YIELD(co);                               \
+    } while (0)
+
+/* Yields, and isn't stepped again before tick 'deadline' */
+#define CO_WAIT_UNTIL(co, deadline)    \
+    do {                               \
+        (co)->wake_tick = (deadline);  \
+        CO_YIELD(co);                  \
+    } while (0)
+
+#define CO_END(co)  \
+    }               \
+    (co)->line = 0; \
+    return true
+
+bool co_start(coroutine *co, const char *name, coroutine_step step, size_t state_size);
+bool run_coroutines();
+bool coroutines_ready();
+bool next_coroutine_wake(uint32_t *wake_tick);
+void print_coroutines();
+
+#endif // COROUTINE_H_
@@ -0,0 +1,211 @@
+#include "instrument.h"
+#include "../cpu/clock.h"
+#include "../cpu/smp.h"
+#include "../drivers/screen.h"
+#include "../libc/atomic.h"
+#include "../libc/function.h"
+#include "../libc/mem.h"
+#include "symbols.h"
+#include "thread.h"
+
+typedef struct InstrumentEntry {
+    uint32_t function; /* 0 for an empty slot */
+    uint32_t calls;
+    uint64_t inclusive;
+    uint64_t exclusive;
+} instrument_entry;
+
+static volatile bool counting = false;
+static instrument_entry *table = NULL;
+static uint32_t functions, dropped, too_deep;
+
+#ifdef INSTRUMENT
+
+/* Everything the hooks call has to stay out of the instrumentation, or they'd call themselves */
+
+NO_INSTRUMENT static inline uint64_t read_tsc() {
+    uint64_t tsc;
+    asm volatile("rdtsc" : "=A"(tsc));
+    return tsc;
+}
+
+/* An interrupt landing in a hook would run more hooks on the same shadow stack */
+NO_INSTRUMENT static inline uint32_t hook_begin() {
+    uint32_t flags;
+    asm volatile("pushf\n"
+                 "pop %0\n"
+                 "cli"
+                 : "=r"(flags)::"memory");
+    return flags;
+}
+
+NO_INSTRUMENT static inline void hook_end(uint32_t flags) {
+    if (flags & EFLAGS_IF)
+        asm volatile("sti" ::: "memory");
+}
+
+static uint32_t generation = 0;
+
+/* The last shadow stack a hook ran on, only ever compared against, as its thread might be gone */
+static instrument_stack *last_stack = NULL;
+
+/**
+ * The current thread's shadow stack, emptied if it's from before the last instrument_start, and with the time
+ * since its last hook taken off its own time if another thread's hooks have run since
+ */
+NO_INSTRUMENT static instrument_stack *own_stack(uint64_t now) {
+    instrument_stack *stack = &thread_current()->shadow;
+    if (stack->generation != generation) {
+        stack->generation = generation;
+        stack->depth = 0;
+        stack->away = 0;
+        stack->left = now;
+    }
+    if (stack != last_stack) {
+        stack->away += now - stack->left;
+        last_stack = stack;
+    }
+    stack->left = now;
+    return stack;
+}
+
+/**
+ * Open addressing with linear probing, a function's slot is taken the first time it returns
+ * Returns NULL once the table's full
+ */
+NO_INSTRUMENT static instrument_entry *lookup(uint32_t function) {
+    uint32_t slot = (function * 2654435761u) >> 22; // Fibonacci hashing down to the 10 bits of INSTRUMENT_SLOTS
+    for (int probe = 0; probe < INSTRUMENT_SLOTS; probe++, slot = (slot + 1) & (INSTRUMENT_SLOTS - 1)) {
+        instrument_entry *entry = &table[slot];
+        if (entry->function == function)
+            return entry;
+        if (entry->function == 0) {
+            entry->function = function;
+            functions++;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+NO_INSTRUMENT void __cyg_profile_func_enter(void *function, void *call_site) {
+    UNUSED(call_site);
+    if (!counting)
+        return;
+
+    uint32_t flags = hook_begin();
+    if (this_cpu()->index == 0) {
+        uint64_t now = read_tsc();
+        instrument_stack *stack = own_stack(now);
+        if (stack->depth < INSTRUMENT_DEPTH) {
+            instrument_frame *frame = &stack->frames[stack->depth];
+            frame->function = (uint32_t)function;
+            frame->start = now - stack->away;
+            frame->children = 0;
+        } else {
+            too_deep++;
+        }
+        stack->depth++;
+    }
+    hook_end(flags);
+}
+
+NO_INSTRUMENT void __cyg_profile_func_exit(void *function, void *call_site) {
+    UNUSED(function);
+    UNUSED(call_site);
+    if (!counting)
+        return;
+
+    uint32_t flags = hook_begin();
+    if (this_cpu()->index == 0) {
+        uint64_t now = read_tsc();
+        instrument_stack *stack = own_stack(now);
+        /* An empty stack means a return from a call made before counting started */
+        if (stack->depth > 0 && --stack->depth < INSTRUMENT_DEPTH) {
+            instrument_frame *frame = &stack->frames[stack->depth];
+            uint64_t elapsed = now - stack->away - frame->start;
+
+            instrument_entry *entry = lookup(frame->function);
+            if (entry != NULL) {
+                entry->calls++;
+                entry->inclusive += elapsed;
+                entry->exclusive += elapsed - frame->children;
+            } else {
+                dropped++;
+            }
+
+            if (stack->depth > 0)
+                stack->frames[stack->depth - 1].children += elapsed;
+        }
+    }
+    hook_end(flags);
+}
+
+#endif
+
+/**
+ * Starts counting from nothing, the table comes off the heap the first time and stays there for the report
+ */
+void instrument_start() {
+#ifndef INSTRUMENT
+    kprintln("This kernel wasn't built with INSTRUMENT, see nix/Makefile");
+#else
+    counting = false;
+    if (table == NULL)
+        table = (instrument_entry *)kmalloc(INSTRUMENT_SLOTS * sizeof(instrument_entry));
+    if (table == NULL) {
+        kprintln("Not enough memory to count calls");
+        return;
+    }
+
+    memory_set((uint8_t *)table, 0, INSTRUMENT_SLOTS * sizeof(instrument_entry));
+    functions = dropped = too_deep = 0;
+    generation++;
+    counting = true;
+#endif
+}
+
+void instrument_stop() {
+    counting = false;
+}
+
+/**
+ * Prints the 'top' functions with the most exclusive time, with their calls and inclusive time alongside
+ */
+void instrument_report(int top) {
+    if (table == NULL) {
+        kprintln("Nothing has been counted, 'instrument start' first");
+        return;
+    }
+
+    uint64_t total = 0;
+    for (int i = 0; i < INSTRUMENT_SLOTS; i++)
+        total += table[i].exclusive;
+
+    kprintlnf("{u} functions, {u} us{}, {u} calls didn't fit, {u} were too deep", functions,
+        (uint32_t)(cycles_to_ns(total) / 1000), counting ? " (still counting)" : "", dropped, too_deep);
+    if (total == 0)
+        return;
+
+    /* Picks out the biggest remaining each time round, marking it taken with the top bit of its calls */
+    for (int shown = 0; shown < top; shown++) {
+        instrument_entry *best = NULL;
+        for (int i = 0; i < INSTRUMENT_SLOTS; i++) {
+            instrument_entry *entry = &table[i];
+            if (entry->function != 0 && !(entry->calls & 0x80000000) &&
+                (best == NULL || entry->exclusive > best->exclusive))
+                best = entry;
+        }
+        if (best == NULL)
+            break;
+
+        uint32_t permille = (uint32_t)(best->exclusive * 1000 / total);
+        kprintlnf("{}: {u} calls, {u} us exclusive ({u}.{u}%), {u} us inclusive", symbol_name(best->function),
+            best->calls, (uint32_t)(cycles_to_ns(best->exclusive) / 1000), permille / 10, permille % 10,
+            (uint32_t)(cycles_to_ns(best->inclusive) / 1000));
+        best->calls |= 0x80000000;
+    }
+
+    for (int i = 0; i < INSTRUMENT_SLOTS; i++)
+        table[i].calls &= ~0x80000000;
+}
@@ -0,0 +1,35 @@
+#ifndef INSTRUMENT_H_
+#define INSTRUMENT_H_
+
+#include "../cpu/types.h"
+
+/* Function-level cycle accounting
+ *
+ * A build with INSTRUMENT set (see nix/Makefile) compiles with -finstrument-functions, so every function calls
+ * __cyg_profile_func_enter on the way in and __cyg_profile_func_exit on the way out. The hooks keep a shadow stack
+ * of TSC stamps per thread, and add each call to its function in a hash table keyed by address: its cycles
+ * inclusive of everything it called, and exclusive, less its callees' inclusive cycles. A thread's stamps are in
+ * its own time, which stops while it's switched out, so a call that blocks isn't charged for whatever ran
+ * meanwhile. Only the bootstrap processor counts. */
+#define INSTRUMENT_DEPTH 48
+#define INSTRUMENT_SLOTS 1024 // A power of two
+
+typedef struct InstrumentFrame {
+    uint32_t function;
+    uint64_t start; /* In the thread's own time */
+    uint64_t children; /* Inclusive cycles of the calls it's made so far */
+} instrument_frame;
+
+typedef struct InstrumentStack {
+    uint32_t generation; /* Which instrument_start it's from, it's emptied if that's not the latest */
+    uint32_t depth; /* Can go past INSTRUMENT_DEPTH, calls that deep are counted in their caller */
+    uint64_t away; /* Cycles spent switched out, the thread's own time is the TSC less this */
+    uint64_t left; /* The TSC at its last hook, which is when it's taken to have been switched out */
+    instrument_frame frames[INSTRUMENT_DEPTH];
+} instrument_stack;
+
+void instrument_start();
+void instrument_stop();
+void instrument_report(int top);
+
+#endif // INSTRUMENT_H_
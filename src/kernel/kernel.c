@@ -1,19 +1,35 @@
 #include "kernel.h"
+#include "../cpu/clock.h"
 #include "../cpu/isr.h"
+#include "../cpu/smp.h"
 #include "../drivers/screen.h"
 #include "../libc/mem.h"
+#include "batch.h"
 #include "scheduler.h"
+#include "thread.h"
 #include "shell.h"
+#include "workqueue.h"
 
 void _start() {
+    init_gdt();
     clear_screen();
 
+    /* Before anything gets allocated over the top of it */
+    bool batch = load_boot_script();
+
+    init_threads();
+    init_clock();
     isr_install();
     irq_install();
 
     init_memory();
+    init_work_queues();
+    start_application_processors(&work_loop);
     init_shell();
 
+    if (batch)
+        schedule(&run_boot_script);
+
     run_scheduler();
 
     asm volatile("cli");
@@ -0,0 +1,230 @@
+#include "lineedit.h"
+#include "../drivers/screen.h"
+#include "../libc/mem.h"
+#include "../libc/string.h"
+
+#define GAP_SIZE(editor) ((editor)->gap_end - (editor)->gap_start)
+
+void line_init(line_editor *editor) {
+    editor->history_count = 0;
+    editor->origin = -1;
+    line_clear(editor);
+}
+
+int line_length(const line_editor *editor) {
+    return LINE_MAX - GAP_SIZE(editor);
+}
+
+int line_cursor(const line_editor *editor) {
+    return editor->gap_start;
+}
+
+bool line_cursor_at_end(const line_editor *editor) {
+    return editor->gap_end == LINE_MAX;
+}
+
+static char char_at(const line_editor *editor, int index) {
+    return index < editor->gap_start ? editor->buffer[index] : editor->buffer[index + GAP_SIZE(editor)];
+}
+
+static void place_cursor(const line_editor *editor) {
+    if (editor->origin >= 0)
+        set_cursor_offset(editor->origin + 2 * editor->gap_start);
+}
+
+/**
+ * Repaints the line from index 'from' onwards, blanking 'erase' more cells after its end
+ * Everything before 'from' is already on screen, so typing at the end of the line paints one cell
+ */
+static void repaint(line_editor *editor, int from, int erase) {
+    if (editor->origin < 0)
+        return;
+
+    int length = line_length(editor);
+
+    /* Scroll until the end of the line, and the cursor after it, fits on screen */
+    while (editor->origin + 2 * (length + 1) > SCREEN_SIZE_BYTES && editor->origin >= 2 * MAX_COLS) {
+        scroll_screen();
+        editor->origin -= 2 * MAX_COLS;
+    }
+
+    for (int i = from; i < length + erase; i++) {
+        int offset = editor->origin + 2 * i;
+        if (offset >= SCREEN_SIZE_BYTES)
+            break;
+        paint(i < length ? char_at(editor, i) : ' ', WHITE_ON_BLACK, get_offset_col(offset), get_offset_row(offset));
+    }
+
+    place_cursor(editor);
+}
+
+/**
+ * Puts the line on screen at the cursor, e.g. just after a prompt
+ */
+void line_show(line_editor *editor) {
+    editor->origin = get_cursor_offset();
+    repaint(editor, 0, 0);
+}
+
+/**
+ * Stops drawing the line, edits still happen and show up with the next line_show
+ */
+void line_hide(line_editor *editor) {
+    editor->origin = -1;
+}
+
+/**
+ * Inserts a character at the cursor
+ * Returns false if the line is full
+ */
+bool line_insert(line_editor *editor, char c) {
+    if (GAP_SIZE(editor) <= 1)
+        return false;
+
+    editor->buffer[editor->gap_start++] = c;
+    repaint(editor, editor->gap_start - 1, 0);
+    return true;
+}
+
+static bool move_left(line_editor *editor) {
+    if (editor->gap_start == 0)
+        return false;
+    editor->buffer[--editor->gap_end] = editor->buffer[--editor->gap_start];
+    return true;
+}
+
+static bool move_right(line_editor *editor) {
+    if (editor->gap_end == LINE_MAX)
+        return false;
+    editor->buffer[editor->gap_start++] = editor->buffer[editor->gap_end++];
+    return true;
+}
+
+/**
+ * Replaces the whole line, leaving the cursor at its end
+ */
+static void load_line(line_editor *editor, const char *text) {
+    int old_length = line_length(editor);
+    int length = strlen(text);
+
+    memory_copy((uint8_t *)text, (uint8_t *)editor->buffer, length);
+    editor->gap_start = length;
+    editor->gap_end = LINE_MAX;
+
+    repaint(editor, 0, old_length > length ? old_length - length : 0);
+}
+
+/**
+ * Copies the line out, terminated, into a LINE_MAX sized buffer
+ */
+static void save_line(const line_editor *editor, char *text) {
+    int length = line_length(editor);
+    for (int i = 0; i < length; i++)
+        text[i] = char_at(editor, i);
+    text[length] = '\0';
+}
+
+static const char *history_entry(const line_editor *editor, uint32_t back) {
+    return editor->history[(editor->history_count - back) % HISTORY_SIZE];
+}
+
+static void history_previous(line_editor *editor) {
+    uint32_t available = editor->history_count < HISTORY_SIZE ? editor->history_count : HISTORY_SIZE;
+    if (editor->browsing == available)
+        return;
+
+    if (editor->browsing == 0)
+        save_line(editor, editor->draft);
+
+    editor->browsing++;
+    load_line(editor, history_entry(editor, editor->browsing));
+}
+
+static void history_next(line_editor *editor) {
+    if (editor->browsing == 0)
+        return;
+
+    editor->browsing--;
+    load_line(editor, editor->browsing == 0 ? editor->draft : history_entry(editor, editor->browsing));
+}
+
+/**
+ * Handles the editing and movement keys
+ * Returns false if the key isn't one of them
+ */
+bool line_edit_key(line_editor *editor, key_event event) {
+    switch (event.keycode) {
+        case KEY_BACKSPACE:
+            if (editor->gap_start > 0) {
+                editor->gap_start--;
+                repaint(editor, editor->gap_start, 1);
+            }
+            break;
+        case KEY_DELETE:
+            if (editor->gap_end < LINE_MAX) {
+                editor->gap_end++;
+                repaint(editor, editor->gap_start, 1);
+            }
+            break;
+        case KEY_LEFT:
+            move_left(editor);
+            place_cursor(editor);
+            break;
+        case KEY_RIGHT:
+            move_right(editor);
+            place_cursor(editor);
+            break;
+        case KEY_HOME:
+            while (move_left(editor))
+                ;
+            place_cursor(editor);
+            break;
+        case KEY_END:
+            while (move_right(editor))
+                ;
+            place_cursor(editor);
+            break;
+        case KEY_UP:
+            history_previous(editor);
+            break;
+        case KEY_DOWN:
+            history_next(editor);
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Finishes the line: moves the gap to the end, terminates the text in place and adds it to the history
+ * The returned text stays valid until the next edit or line_clear
+ * The cursor is left after the line on screen, and the line stops being drawn
+ */
+char *line_submit(line_editor *editor) {
+    while (move_right(editor))
+        ;
+    place_cursor(editor);
+    editor->origin = -1;
+
+    editor->buffer[editor->gap_start] = '\0';
+
+    bool repeated = editor->history_count > 0 && strcmp(history_entry(editor, 1), editor->buffer) == 0;
+    if (editor->gap_start > 0 && !repeated) {
+        memory_copy((uint8_t *)editor->buffer, (uint8_t *)editor->history[editor->history_count % HISTORY_SIZE],
+            editor->gap_start + 1);
+        editor->history_count++;
+    }
+    editor->browsing = 0;
+
+    return editor->buffer;
+}
+
+/**
+ * Empties the line, without touching the screen
+ */
+void line_clear(line_editor *editor) {
+    editor->gap_start = 0;
+    editor->gap_end = LINE_MAX;
+    editor->browsing = 0;
+}
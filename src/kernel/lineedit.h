@@ -0,0 +1,42 @@
+#ifndef LINEEDIT_H_
+#define LINEEDIT_H_
+
+#include "../cpu/types.h"
+#include "../drivers/keyboard.h"
+
+/* Line editing over a gap buffer
+ *
+ * The text is buffer[0, gap_start) followed by buffer[gap_end, LINE_MAX), and the gap sits at the cursor,
+ * so typing and deleting at the cursor are O(1) and only moving the cursor shuffles characters across.
+ * One byte of gap is always kept back, so a submitted line can be terminated in place. */
+#define LINE_MAX 256
+#define HISTORY_SIZE 16
+
+typedef struct LineEditor {
+    char buffer[LINE_MAX];
+    int gap_start; /* Also the cursor */
+    int gap_end;
+    int origin; /* Screen offset of the first character, -1 while the line isn't on screen */
+
+    /* Submitted lines, the newest at (history_count - 1) % HISTORY_SIZE */
+    char history[HISTORY_SIZE][LINE_MAX];
+    uint32_t history_count;
+    uint32_t browsing; /* How far back up the history the line is, 0 for the line being typed */
+    char draft[LINE_MAX]; /* The line being typed, kept while browsing */
+} line_editor;
+
+void line_init(line_editor *editor);
+void line_show(line_editor *editor);
+void line_hide(line_editor *editor);
+
+int line_length(const line_editor *editor);
+int line_cursor(const line_editor *editor);
+bool line_cursor_at_end(const line_editor *editor);
+
+bool line_insert(line_editor *editor, char c);
+bool line_edit_key(line_editor *editor, key_event event);
+
+char *line_submit(line_editor *editor);
+void line_clear(line_editor *editor);
+
+#endif // LINEEDIT_H_
@@ -0,0 +1,87 @@
+#include "pacer.h"
+#include "../cpu/timer.h"
+#include "../drivers/screen.h"
+
+static pacer *pacers[MAX_PACERS];
+static int pacer_count = 0;
+
+/**
+ * Starts (or restarts) pacing from now, with the first frame due straight away
+ * Pacers are kept track of for print_pacers, up to MAX_PACERS of them
+ */
+void pacer_start(pacer *p, const char *name, uint32_t period) {
+    p->name = name;
+    p->period = period > 0 ? period : 1;
+    p->due = p->started = get_tick();
+    p->frames = 1;
+    p->late = p->dropped = 0;
+    histogram_reset(&p->work);
+    histogram_reset(&p->lag);
+
+    for (int i = 0; i < pacer_count; i++) {
+        if (pacers[i] == p)
+            return;
+    }
+    if (pacer_count < MAX_PACERS)
+        pacers[pacer_count++] = p;
+}
+
+/**
+ * Ends the current frame and works out when the one 'frames' frames on is due
+ * If that's already gone by, the frame was late, and the deadline moves on to the next one still to come
+ * Returns the tick to wait until
+ */
+uint32_t pacer_next(pacer *p, uint32_t frames) {
+    uint32_t now = get_tick();
+    histogram_add(&p->work, now - p->started);
+
+    uint32_t due = p->due + frames * p->period;
+    if ((int32_t)(now - due) > 0) {
+        uint32_t missed = (now - due + p->period - 1) / p->period;
+        p->late++;
+        p->dropped += missed;
+        due += missed * p->period;
+    }
+
+    p->due = due;
+    return due;
+}
+
+/**
+ * Marks the frame pacer_next gave the deadline for as started
+ */
+void pacer_begin_frame(pacer *p) {
+    p->started = get_tick();
+    histogram_add(&p->lag, p->started - p->due);
+    p->frames++;
+}
+
+/**
+ * Ends the current frame and sleeps until the one 'frames' frames on is due
+ */
+void pacer_wait(pacer *p, uint32_t frames) {
+    uint32_t due = pacer_next(p, frames);
+    int32_t remaining = due - get_tick();
+    if (remaining > 0)
+        sleep(remaining);
+    pacer_begin_frame(p);
+}
+
+/**
+ * Calls 'frame' once a period until it returns false
+ */
+void pacer_run(pacer *p, pacer_frame frame, void *data) {
+    while ((*frame)(data))
+        pacer_wait(p, 1);
+}
+
+void print_pacers() {
+    for (int i = 0; i < pacer_count; i++) {
+        const pacer *p = pacers[i];
+        kprintlnf("{}: {u} frames at {u} ticks each, {u} late, {u} dropped", p->name, p->frames, p->period, p->late,
+            p->dropped);
+        kprintlnf("  Work: {u} ticks p50, {u} p99, {u} max against a budget of {u}", histogram_percentile(&p->work, 50),
+            histogram_percentile(&p->work, 99), p->work.max, p->period);
+        kprintlnf("  Start after deadline: {u} ticks p50, {u} max", histogram_percentile(&p->lag, 50), p->lag.max);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef PACER_H_
+#define PACER_H_
+
+#include "../cpu/types.h"
+#include "../libc/histogram.h"
+#include "coroutine.h"
+
+/* Fixed-rate frame pacing for animated programs
+ *
+ * Frames are due on a grid of absolute ticks, one every 'period', and each wait is until the next one is due
+ * rather than for a delay from now, so the time spent drawing doesn't drag the rate down. A frame whose work
+ * runs past the next deadline is late, and the frames it overran are dropped rather than run back to back
+ * to catch up. */
+#define MAX_PACERS 4
+
+typedef struct Pacer {
+    const char *name;
+    uint32_t period;  /* Ticks per frame, the budget for each one's work */
+    uint32_t due;     /* Tick the current frame was due */
+    uint32_t started; /* Tick the current frame actually started */
+    uint32_t frames;
+    uint32_t late;    /* Frames whose work overran the next deadline */
+    uint32_t dropped; /* Frames skipped because of them */
+    histogram work;   /* Ticks from a frame starting to it asking for the next one */
+    histogram lag;    /* Ticks from a frame being due to it starting */
+} pacer;
+
+typedef bool (*pacer_frame)(void *data); /* Returns false to stop */
+
+void pacer_start(pacer *p, const char *name, uint32_t period);
+uint32_t pacer_next(pacer *p, uint32_t frames);
+void pacer_begin_frame(pacer *p);
+void pacer_wait(pacer *p, uint32_t frames);
+void pacer_run(pacer *p, pacer_frame frame, void *data);
+void print_pacers();
+
+/* The coroutine version of pacer_wait */
+#define CO_PACE(co, p, frames)                           \
+    do {                                                 \
+        CO_WAIT_UNTIL(co, pacer_next((p), (frames)));    \
+        pacer_begin_frame(p);                            \
+    } while (0)
+
+#endif // PACER_H_
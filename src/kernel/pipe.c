@@ -0,0 +1,85 @@
+#include "pipe.h"
+#include "../drivers/screen.h"
+#include "../libc/mem.h"
+
+static pipe_buffer *capturing = NULL;
+static output_sink previous_sink;
+
+static void capture_sink(const char *message, int length) {
+    int space = PIPE_BUFFER_SIZE - 1 - capturing->length;
+    if (length > space) {
+        length = space;
+        capturing->truncated = true;
+    }
+
+    memory_copy((uint8_t *)message, (uint8_t *)&capturing->data[capturing->length], length);
+    capturing->length += length;
+    capturing->data[capturing->length] = '\0';
+}
+
+/**
+ * Empties the buffer and sends everything printed at the cursor into it, until release_output
+ * Nothing captured goes anywhere near video memory
+ * Returns false, capturing nothing, if there isn't the memory for the buffer
+ */
+bool capture_output(pipe_buffer *buffer) {
+    if (buffer->data == NULL)
+        buffer->data = (char *)kmalloc(PIPE_BUFFER_SIZE);
+    if (buffer->data == NULL)
+        return false;
+
+    buffer->length = 0;
+    buffer->truncated = false;
+    buffer->data[0] = '\0';
+
+    capturing = buffer;
+    previous_sink = swap_output_sink(&capture_sink);
+    return true;
+}
+
+void release_output() {
+    return_output_sink(previous_sink);
+    capturing = NULL;
+}
+
+slice pipe_contents(const pipe_buffer *buffer) {
+    slice contents = {buffer->data, buffer->length};
+    return contents;
+}
+
+typedef struct NamedBuffer {
+    char name[BUFFER_NAME_MAX];
+    pipe_buffer buffer;
+} named_pipe_buffer;
+
+static named_pipe_buffer named_buffers[MAX_NAMED_BUFFERS];
+static int named_count = 0;
+
+/**
+ * Finds the buffer with the given name, making it if 'create' is set and there's room
+ * Returns NULL if there's no such buffer, or no room for it
+ */
+pipe_buffer *named_buffer(slice name, bool create) {
+    if (name.length == 0 || name.length >= BUFFER_NAME_MAX)
+        return NULL;
+
+    for (int i = 0; i < named_count; i++) {
+        if (slice_equals(name, named_buffers[i].name))
+            return &named_buffers[i].buffer;
+    }
+
+    if (!create || named_count == MAX_NAMED_BUFFERS)
+        return NULL;
+
+    named_pipe_buffer *named = &named_buffers[named_count++];
+    memory_copy((uint8_t *)name.start, (uint8_t *)named->name, name.length);
+    named->name[name.length] = '\0';
+    named->buffer.data = NULL;
+    named->buffer.length = 0;
+    return &named->buffer;
+}
+
+void list_named_buffers() {
+    for (int i = 0; i < named_count; i++)
+        kprintlnf("{}: {u} bytes", named_buffers[i].name, named_buffers[i].buffer.length);
+}
@@ -0,0 +1,25 @@
+#ifndef PIPE_H_
+#define PIPE_H_
+
+#include "../cpu/types.h"
+#include "../libc/string.h"
+
+/* In-memory buffers that command output can be captured into, for pipelines and '> name' */
+#define PIPE_BUFFER_SIZE 8192
+#define MAX_NAMED_BUFFERS 8
+#define BUFFER_NAME_MAX 16
+
+typedef struct PipeBuffer {
+    char *data; /* Allocated on first capture, always null terminated */
+    int length;
+    bool truncated; /* Output was dropped because the buffer filled up */
+} pipe_buffer;
+
+bool capture_output(pipe_buffer *buffer);
+void release_output();
+slice pipe_contents(const pipe_buffer *buffer);
+
+pipe_buffer *named_buffer(slice name, bool create);
+void list_named_buffers();
+
+#endif // PIPE_H_
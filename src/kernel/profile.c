@@ -0,0 +1,159 @@
+#include "profile.h"
+#include "../drivers/debugcon.h"
+#include "../drivers/screen.h"
+#include "../libc/mem.h"
+#include "symbols.h"
+
+#define MAX_FRAME 0x10000 // Furthest apart two frames on the same stack can be
+
+typedef struct ProfileStack {
+    uint32_t depth;
+    uint32_t pcs[PROFILE_DEPTH]; /* The sampled EIP first, then the return addresses above it */
+} profile_stack;
+
+static volatile bool running = false;
+static uint32_t interval = 1, countdown = 1;
+
+static uint32_t *counts = NULL; /* Per symbol, indexed like kernel_symbols */
+static profile_stack *stacks = NULL;
+static uint32_t samples, unknown, stacks_kept, stacks_dropped;
+
+/**
+ * Starts sampling every 'interval' ticks, throwing away what was there from last time
+ * The buffers come off the heap, and stay there for the report after stopping
+ */
+void profile_start(uint32_t ticks) {
+    running = false;
+    if (kernel_symbol_count == 0) {
+        kprintln("This kernel was built without its symbol table");
+        return;
+    }
+
+    if (counts == NULL)
+        counts = (uint32_t *)kmalloc(kernel_symbol_count * sizeof(uint32_t));
+    if (stacks == NULL)
+        stacks = (profile_stack *)kmalloc(PROFILE_STACKS * sizeof(profile_stack));
+    if (counts == NULL || stacks == NULL) {
+        kprintln("Not enough memory to profile");
+        return;
+    }
+
+    memory_set((uint8_t *)counts, 0, kernel_symbol_count * sizeof(uint32_t));
+    samples = unknown = stacks_kept = stacks_dropped = 0;
+    interval = countdown = ticks > 0 ? ticks : 1;
+    running = true;
+}
+
+void profile_stop() {
+    running = false;
+}
+
+bool profile_running() {
+    return running;
+}
+
+/**
+ * Follows the saved frame pointers up from the interrupted function
+ * Each frame is [saved ebp, return address], and has to be further up the same stack than the last,
+ * which stops the walk at the outermost frame or anything that isn't a frame
+ */
+static void walk_stack(const registers_t *regs, profile_stack *stack) {
+    stack->pcs[0] = regs->eip;
+    stack->depth = 1;
+
+    uint32_t previous = regs->esp;
+    uint32_t *frame = (uint32_t *)regs->ebp;
+    while (stack->depth < PROFILE_DEPTH) {
+        uint32_t address = (uint32_t)frame;
+        if (address <= previous || address - previous > MAX_FRAME || (address & 3) != 0)
+            break;
+
+        uint32_t return_address = frame[1];
+        if (find_symbol(return_address) < 0)
+            break;
+
+        stack->pcs[stack->depth++] = return_address;
+        previous = address;
+        frame = (uint32_t *)frame[0];
+    }
+}
+
+/**
+ * Called from the timer IRQ with the registers it interrupted
+ */
+void profile_sample(const registers_t *regs) {
+    if (!running || --countdown > 0)
+        return;
+    countdown = interval;
+
+    samples++;
+    int index = find_symbol(regs->eip);
+    if (index < 0)
+        unknown++;
+    else
+        counts[index]++;
+
+    if (stacks_kept < PROFILE_STACKS)
+        walk_stack(regs, &stacks[stacks_kept++]);
+    else
+        stacks_dropped++;
+}
+
+/**
+ * Prints the 'top' functions with the most samples, the ones the interrupted EIP was in
+ */
+void profile_report(int top) {
+    if (counts == NULL) {
+        kprintln("Nothing has been profiled, 'profile start' first");
+        return;
+    }
+
+    kprintlnf("{u} samples, every {u} ticks{}, {u} outside the kernel's code", samples, interval,
+        running ? " (still running)" : "", unknown);
+    if (samples == 0)
+        return;
+
+    /* Picks out the biggest remaining each time round, marking it taken with the top bit */
+    for (int shown = 0; shown < top; shown++) {
+        int best = -1;
+        for (uint32_t i = 0; i < kernel_symbol_count; i++) {
+            if (!(counts[i] & 0x80000000) && counts[i] != 0 && (best < 0 || counts[i] > counts[best]))
+                best = i;
+        }
+        if (best < 0)
+            break;
+
+        uint32_t permille = counts[best] * 1000 / samples;
+        kprintlnf("{u}  {u}.{u}%  {}", counts[best], permille / 10, permille % 10, kernel_symbols[best].name);
+        counts[best] |= 0x80000000;
+    }
+
+    for (uint32_t i = 0; i < kernel_symbol_count; i++)
+        counts[i] &= ~0x80000000;
+}
+
+/**
+ * Writes the kept stacks out of the debug port, a JSON line each like the benchmarks, holding the folded stack:
+ * 'outermost;...;sampled'. Identical stacks are summed by the flamegraph tools, so they aren't merged here
+ */
+void profile_export() {
+    if (stacks == NULL || stacks_kept == 0) {
+        kprintln("No stacks to export");
+        return;
+    }
+
+    bool was_running = running;
+    running = false;
+
+    for (uint32_t i = 0; i < stacks_kept; i++) {
+        const profile_stack *stack = &stacks[i];
+        debug_print("{\"stack\":\"");
+        for (int level = stack->depth - 1; level >= 0; level--) {
+            debug_print(symbol_name(stack->pcs[level]));
+            debug_print(level > 0 ? ";" : "\",\"samples\":1}\n");
+        }
+    }
+
+    kprintlnf("Exported {u} stacks to the debug port, {u} more didn't fit", stacks_kept, stacks_dropped);
+    running = was_running;
+}
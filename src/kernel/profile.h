@@ -0,0 +1,24 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include "../cpu/isr.h"
+#include "../cpu/types.h"
+
+/* Sampling profiler
+ *
+ * Every 'interval' timer ticks the IRQ takes the EIP it interrupted and counts it against the function it's
+ * in, looked up in the kernel's symbol table. It also walks the saved frame pointers up the interrupted stack,
+ * keeping up to PROFILE_STACKS whole stacks to export as folded stacks (root first, ';' between functions),
+ * which is what flamegraph tooling takes. */
+#define PROFILE_DEPTH 12
+#define PROFILE_STACKS 512
+
+void profile_start(uint32_t interval);
+void profile_stop();
+bool profile_running();
+void profile_sample(const registers_t *regs);
+
+void profile_report(int top);
+void profile_export();
+
+#endif // PROFILE_H_
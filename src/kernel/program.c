@@ -4,38 +4,64 @@
 #include "../drivers/keyboard.h"
 #include "../drivers/screen.h"
 #include "../libc/mem.h"
+#include "coroutine.h"
+#include "pacer.h"
 
 static volatile bool running = true;
 
-void program_key_handler(uint8_t scancode) {
-    if (scancode == 16) {
+void program_key_handler(key_event event) {
+    if (KEY_PRESSED(event) && event.keycode == KEY_Q) {
         running = false;
     }
 }
 
-void program() {
-    static screenstate *prev_screen = NULL;
-    if (prev_screen == NULL)
-        prev_screen = (screenstate *)kmalloc_naive(sizeof(screenstate), false, NULL);
+/* Everything that has to last between steps */
+typedef struct ProgramState {
+    screenstate *prev_screen;
+    keyhandler previous_handler;
+    int col;
+    int color;
+} program_state;
 
-    save_screen_to(prev_screen);
+static program_state state = {NULL};
+static coroutine program_coroutine;
+static pacer program_pacer;
+
+static bool program_step(coroutine *co) {
+    CO_BEGIN(co);
+
+    if (state.prev_screen == NULL)
+        state.prev_screen = (screenstate *)kmalloc_naive(sizeof(screenstate), false, NULL);
+
+    save_screen_to(state.prev_screen);
     clear_screen();
 
-    keyhandler previous_handler = swap_key_handler(&program_key_handler);
+    state.previous_handler = swap_key_handler(&program_key_handler);
 
-    int col = 0;
-    int color = 0;
+    state.col = 0;
+    state.color = 0;
+    pacer_start(&program_pacer, "program", 20);
     while (running) {
-        paint(' ', color << 4, col, 0);
-        if (++col == MAX_COLS) {
-            col = 0;
-            if (++color == 0x10)
-                color = 0;
+        paint(' ', state.color << 4, state.col, 0);
+        if (++state.col == MAX_COLS) {
+            state.col = 0;
+            if (++state.color == 0x10)
+                state.color = 0;
         }
-        wait(20);
+        CO_PACE(co, &program_pacer, 1);
     }
 
     running = true;
-    load_screen_from(prev_screen);
-    return_key_handler(previous_handler);
+    load_screen_from(state.prev_screen);
+    return_key_handler(state.previous_handler);
+
+    CO_END(co);
+}
+
+/**
+ * Starts the program as a coroutine, it runs a step at a time from the scheduler loop
+ * Returns false if it's already running
+ */
+bool program() {
+    return co_start(&program_coroutine, "program", &program_step, sizeof(program_state));
 }
@@ -1,6 +1,8 @@
 #ifndef PROGRAM_H_
 #define PROGRAM_H_
 
-void program();
+#include "../cpu/types.h"
+
+bool program();
 
 #endif // PROGRAM_H_
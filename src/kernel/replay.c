@@ -0,0 +1,277 @@
+#include "replay.h"
+#include "../cpu/timer.h"
+#include "../drivers/keyboard.h"
+#include "../drivers/screen.h"
+#include "../libc/mem.h"
+#include "scheduler.h"
+
+/* Scancode record/replay, for driving the shell deterministically
+ *
+ * Recording captures every byte the keyboard IRQ reads, with the tick it arrived on.
+ * Replay feeds a recording (or a generated script) back in through inject_scancode,
+ * so everything from the bottom half onwards runs exactly as it would for real typing.
+ * Every replay ends by typing "replay mark", which reports how long the whole stream took
+ * once the shell has actually dispatched everything in front of it. */
+
+typedef struct RecordedScancode {
+    uint32_t tick; /* Ticks since recording started */
+    uint8_t scancode;
+} recorded_scancode;
+
+#define RECORD_MAX 8192
+
+static recorded_scancode *recording = NULL;
+static volatile uint32_t recorded = 0;
+static uint32_t record_start_tick;
+/* So "record stop" can be cut back off: lines start just after an Enter release, and the last line's release
+ * may or may not have come in by the time it's dispatched (on the press) */
+static uint32_t line_start, previous_line_start;
+static bool enter_down;
+
+static void record_scancode(uint8_t scancode) {
+    if (recorded == RECORD_MAX)
+        return;
+
+    if (scancode == KEY_ENTER) {
+        enter_down = true;
+    } else if (scancode == (KEY_ENTER | SCANCODE_BREAK)) {
+        enter_down = false;
+        previous_line_start = line_start;
+        line_start = recorded + 1;
+    }
+
+    recording[recorded].tick = get_tick() - record_start_tick;
+    recording[recorded].scancode = scancode;
+    recorded++;
+}
+
+void record_start() {
+    if (recording == NULL)
+        recording = (recorded_scancode *)kmalloc(RECORD_MAX * sizeof(recorded_scancode));
+
+    if (recording == NULL) {
+        kprintln("Not enough memory to record");
+        return;
+    }
+
+    recorded = line_start = previous_line_start = 0;
+    enter_down = false;
+    record_start_tick = get_tick();
+    register_scancode_recorder(&record_scancode);
+    kprintlnf("Recording up to {i} scancodes", RECORD_MAX);
+}
+
+void record_stop() {
+    register_scancode_recorder(NULL);
+
+    /* Drop the line that typed this command, keeping the release of the Enter before it */
+    recorded = enter_down ? line_start : previous_line_start;
+    kprintlnf("Recorded {u} scancodes over {u} ticks", recorded, recorded ? recording[recorded - 1].tick : 0);
+}
+
+/////////// Replay //////////
+
+enum ReplaySource { RECORDING, SCRIPT, MARKER };
+
+/* Typed over and over by 'replay bench', a mix of echo-heavy and dispatch-heavy lines */
+static const char bench_script[] = "echo The quick brown fox jumps over the lazy dog\n"
+                                   "uptime\n"
+                                   "keyboard\n";
+
+static const char marker_script[] = "replay mark\n";
+
+static struct {
+    bool active;
+    bool fast;
+    enum ReplaySource source;
+    uint32_t position;
+    uint32_t repetitions;
+    int pending; /* Scancode the ring had no room for, NO_SCANCODE if none */
+
+    /* Script state: which character, and which part of typing it we are on */
+    const char *script;
+    uint8_t stage;
+
+    uint32_t start_tick;
+    uint32_t scancodes;
+    uint32_t commands;
+} replay;
+
+enum TypingStage { PRESS_SHIFT, PRESS_KEY, RELEASE_KEY, RELEASE_SHIFT };
+
+/* Stream results that aren't scancodes */
+#define NO_SCANCODE -1
+#define STREAM_DONE -2
+#define NOT_DUE -3
+
+/**
+ * Produces the next scancode for typing 'replay.script', a character takes up to four
+ * Returns STREAM_DONE once the script runs out
+ */
+static int next_script_scancode() {
+    while (replay.script[replay.position] != '\0') {
+        char c = replay.script[replay.position];
+        uint8_t keycode;
+        bool shift;
+
+        if (c == '\n') {
+            keycode = KEY_ENTER;
+            shift = false;
+        } else if (!get_key_for_char(c, &keycode, &shift)) {
+            replay.position++;
+            continue;
+        }
+
+        switch (replay.stage++) {
+            case PRESS_SHIFT:
+                if (shift)
+                    return KEY_LSHIFT;
+                replay.stage++;
+                /* fall through */
+            case PRESS_KEY:
+                return keycode;
+            case RELEASE_KEY:
+                if (!shift) {
+                    replay.stage = PRESS_SHIFT;
+                    replay.position++;
+                }
+                return keycode | SCANCODE_BREAK;
+            case RELEASE_SHIFT:
+                replay.stage = PRESS_SHIFT;
+                replay.position++;
+                return KEY_LSHIFT | SCANCODE_BREAK;
+        }
+    }
+
+    return STREAM_DONE;
+}
+
+static void start_script(enum ReplaySource source, const char *script) {
+    replay.source = source;
+    replay.script = script;
+    replay.position = 0;
+    replay.stage = PRESS_SHIFT;
+}
+
+/**
+ * Produces the next scancode of the replay, moving on to the end marker when the stream runs out
+ * Returns STREAM_DONE once the marker has been typed too, or NOT_DUE if the next one is being held back
+ */
+static int next_scancode() {
+    int scancode = STREAM_DONE;
+
+    switch (replay.source) {
+        case RECORDING:
+            if (replay.position < recorded) {
+                /* At the original pace, hold back anything that isn't due yet */
+                if (!replay.fast && recording[replay.position].tick > get_tick() - replay.start_tick)
+                    return NOT_DUE;
+
+                scancode = recording[replay.position++].scancode;
+            }
+            break;
+        case SCRIPT:
+            scancode = next_script_scancode();
+            if (scancode == STREAM_DONE && --replay.repetitions > 0) {
+                start_script(SCRIPT, bench_script);
+                scancode = next_script_scancode();
+            }
+            break;
+        case MARKER:
+            return next_script_scancode();
+    }
+
+    if (scancode == STREAM_DONE) {
+        /* Stream is done, type the marker without counting it */
+        start_script(MARKER, marker_script);
+        return next_script_scancode();
+    }
+
+    replay.scancodes++;
+    if (scancode == KEY_ENTER)
+        replay.commands++;
+
+    return scancode;
+}
+
+/**
+ * Scheduled over and over until the whole stream has been injected
+ * Each run fills the ring as far as it can, then gets out of the way so the bottom half can drain it
+ */
+static void replay_step() {
+    while (true) {
+        if (replay.pending == NO_SCANCODE)
+            replay.pending = next_scancode();
+
+        if (replay.pending == STREAM_DONE)
+            return; /* The marker will report back */
+
+        if (replay.pending == NOT_DUE) {
+            replay.pending = NO_SCANCODE;
+            break;
+        }
+
+        if (!inject_scancode(replay.pending))
+            break;
+
+        replay.pending = NO_SCANCODE;
+    }
+
+    schedule(&replay_step);
+}
+
+/**
+ * Checked before any of the replay's state is touched, so starting another can't disturb the running one
+ */
+static bool replay_running() {
+    if (replay.active)
+        kprintln("A replay is already running");
+    return replay.active;
+}
+
+static void begin_replay(bool fast) {
+    replay.active = true;
+    replay.fast = fast;
+    replay.pending = NO_SCANCODE;
+    replay.scancodes = replay.commands = 0;
+    replay.start_tick = get_tick();
+    schedule(&replay_step);
+}
+
+void replay_recording(bool fast) {
+    if (replay_running())
+        return;
+    if (recorded == 0) {
+        kprintln("Nothing has been recorded");
+        return;
+    }
+
+    replay.source = RECORDING;
+    replay.position = 0;
+    begin_replay(fast);
+}
+
+void replay_script(uint32_t repetitions) {
+    if (replay_running() || repetitions == 0)
+        return;
+
+    start_script(SCRIPT, bench_script);
+    replay.repetitions = repetitions;
+    begin_replay(true);
+}
+
+/**
+ * The completion marker, run when the shell dispatches the "replay mark" line at the end of a replay
+ * Everything typed before it has been echoed and dispatched by now
+ */
+void replay_mark() {
+    if (!replay.active)
+        return;
+
+    replay.active = false;
+    uint32_t elapsed = get_tick() - replay.start_tick;
+
+    kprintlnf("Replayed {u} scancodes, {u} commands in {u} ms", replay.scancodes, replay.commands, elapsed);
+    if (elapsed > 0)
+        kprintlnf("{u} commands per second", replay.commands * 1000 / elapsed);
+}
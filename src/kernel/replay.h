@@ -0,0 +1,13 @@
+#ifndef REPLAY_H_
+#define REPLAY_H_
+
+#include "../cpu/types.h"
+
+void record_start();
+void record_stop();
+
+void replay_recording(bool fast);
+void replay_script(uint32_t repetitions);
+void replay_mark();
+
+#endif // REPLAY_H_
@@ -1,22 +1,232 @@
 #include "scheduler.h"
+#include "../cpu/smp.h"
+#include "../cpu/timer.h"
 #include "../cpu/types.h"
 #include "../drivers/screen.h"
+#include "../libc/atomic.h"
+#include "../libc/lock.h"
+#include "../libc/trace.h"
+#include "coroutine.h"
+#include "thread.h"
 
-schedulable scheduled[256];
+/* Run queue: a ring per priority that anything (IRQs included) can add to, and only the scheduler loop takes from
+ * The indices only ever increase, so head - tail is the number queued even across wraps
+ * Bit n of ready_levels is set while level n has anything queued, so the next task is a bsf away */
+#define RUN_QUEUE_SIZE 128 // Per level, must be a power of two
+
+static schedulable run_queue[PRIORITY_LEVELS][RUN_QUEUE_SIZE];
+static volatile uint32_t queue_head[PRIORITY_LEVELS]; /* Next free slot */
+static volatile uint32_t queue_tail[PRIORITY_LEVELS]; /* Next to run */
+static volatile uint32_t ready_levels = 0;
+static ticket_lock run_queue_lock = TICKET_LOCK("run queue");
+static volatile uint32_t dropped = 0, reported_dropped = 0;
 
 static bool is_active = true;
-static uint8_t current, running = 0;
 
-void schedule(schedulable program) {
-    /* kprintlnf("Scheduling {i}", current); */
-    scheduled[current++] = program;
+/**
+ * Queues a task to run from the scheduler loop at the given priority
+ * Safe from interrupt handlers and other CPUs, the run queue lock is held with interrupts off
+ * Returns false, and counts it for the scheduler to report, if that level is full
+ */
+bool schedule_at(schedulable program, int priority) {
+    TRACE(TRACE_SCHEDULE, program, priority);
+    uint32_t flags = ticket_acquire_irqsave(&run_queue_lock);
+
+    bool queued = queue_head[priority] - queue_tail[priority] != RUN_QUEUE_SIZE;
+    if (queued) {
+        run_queue[priority][queue_head[priority]++ % RUN_QUEUE_SIZE] = program;
+        ready_levels |= 1 << priority;
+    } else
+        dropped++;
+
+    ticket_release_irqrestore(&run_queue_lock, flags);
+    return queued;
+}
+
+/**
+ * Queues a task at normal priority, or boosted to interactive while a key is being handled
+ * The boost is just for that run, a task that reschedules itself later goes back in at normal
+ */
+bool schedule(schedulable program) {
+    return schedule_at(program, this_cpu()->interactive ? PRIORITY_INTERACTIVE : PRIORITY_NORMAL);
+}
+
+/**
+ * Marks whether what's running on this CPU is handling input, so anything it schedules is boosted
+ * Kept per CPU, so another CPU scheduling meanwhile doesn't get the boost too
+ * Returns what it was before, to put back afterwards
+ */
+bool set_interactive(bool now_interactive) {
+    cpu *self = this_cpu();
+    bool was_interactive = self->interactive;
+    self->interactive = now_interactive;
+    return was_interactive;
+}
+
+/**
+ * Takes the next task off the highest priority level with anything queued, or NULL if there isn't one
+ * Locked so anyone queueing to the same level can't race the bit being cleared
+ */
+static schedulable next_task() {
+    if (ready_levels == 0)
+        return NULL;
+
+    uint32_t flags = ticket_acquire_irqsave(&run_queue_lock);
+
+    uint32_t level;
+    asm("bsf %1, %0" : "=r"(level) : "rm"(ready_levels));
+
+    schedulable task = run_queue[level][queue_tail[level] % RUN_QUEUE_SIZE];
+    run_queue[level][queue_tail[level] % RUN_QUEUE_SIZE] = NULL;
+    if (++queue_tail[level] == queue_head[level])
+        ready_levels &= ~(1 << level);
+
+    ticket_release_irqrestore(&run_queue_lock, flags);
+    return task;
+}
+
+static uint32_t count_queued() {
+    uint32_t queued = 0;
+    for (int level = 0; level < PRIORITY_LEVELS; level++)
+        queued += queue_head[level] - queue_tail[level];
+    return queued;
+}
+
+static volatile bool idle = false;
+static volatile uint32_t busy_ticks = 0, idle_ticks = 0;
+
+/**
+ * Marks the CPU as idle (spinning with nothing to do) or busy
+ * Returns what it was before, to put back afterwards
+ */
+bool set_idle(bool now_idle) {
+    bool was_idle = idle;
+    idle = now_idle;
+    return was_idle;
+}
+
+bool is_idle() {
+    return idle;
+}
+
+/**
+ * Charges ticks to busy or idle, called from the timer IRQ
+ * Tickless idle can cover many ticks with one interrupt, they were all idle
+ */
+void account_ticks(uint32_t ticks) {
+    if (idle)
+        idle_ticks += ticks;
+    else
+        busy_ticks += ticks;
+}
+
+scheduler_stats get_scheduler_stats() {
+    scheduler_stats stats = {
+        .busy_ticks = busy_ticks,
+        .idle_ticks = idle_ticks,
+        .queued = count_queued(),
+        .dropped = dropped,
+    };
+    return stats;
+}
+
+static schedulable bottom_halves[MAX_BOTTOM_HALVES];
+static int bottom_half_count = 0;
+static atomic_uint pending_bottom_halves = ATOMIC_INIT(0);
+
+/**
+ * Registers a bottom half, returning the id to raise it with
+ * Returns -1 if every slot is already taken
+ */
+int register_bottom_half(schedulable bottom_half) {
+    if (bottom_half_count == MAX_BOTTOM_HALVES)
+        return -1;
+
+    bottom_halves[bottom_half_count] = bottom_half;
+    return bottom_half_count++;
+}
+
+/**
+ * Marks a bottom half as pending
+ * Safe to call from interrupt handlers, a single locked 'or' can't be torn
+ * Bottom halves only run on the boot thread, so it's boosted to run next
+ * Ids that weren't handed out by register_bottom_half are ignored
+ */
+void raise_bottom_half(int id) {
+    if (id < 0 || id >= bottom_half_count)
+        return;
+
+    atomic_or(&pending_bottom_halves, 1 << id);
+    thread_boost_boot();
+}
+
+/**
+ * Runs every pending bottom half once
+ * Called from the scheduler loop and from anything that busy-waits, so deferred
+ * interrupt work still happens while a long-running program holds the CPU
+ */
+void run_bottom_halves() {
+    static bool in_bottom_half = false;
+    if (in_bottom_half)
+        return;
+
+    /* Atomically take the pending set, anything raised after this runs next time */
+    uint32_t pending = atomic_exchange(&pending_bottom_halves, 0);
+
+    if (pending == 0)
+        return;
+
+    in_bottom_half = true;
+    bool was_idle = set_idle(false);
+    for (int i = 0; pending != 0; i++, pending >>= 1) {
+        if (pending & 1)
+            (*bottom_halves[i])();
+    }
+    set_idle(was_idle);
+    in_bottom_half = false;
+}
+
+/**
+ * Halts until the next interrupt, unless there's already work (or a thread or coroutine) waiting
+ * Interrupts are off while checking, and 'sti; hlt' can't be split by one, so a wakeup can't slip in between
+ * In tickless mode the timer is stretched to the next thing due for the halt, and back to ticking after
+ */
+void idle_until_interrupt() {
+    irq_disable();
+    if (atomic_load(&pending_bottom_halves) == 0 && ready_levels == 0 && !threads_ready() && !coroutines_ready()) {
+        timer_idle_enter();
+        IRQSOFF_END();
+        asm volatile("sti; hlt");
+        irq_disable();
+        timer_idle_exit();
+    }
+    irq_enable();
 }
 
 void run_scheduler() {
     while (is_active) {
-        if (running != current && scheduled[running] != NULL) {
-            /* kprintlnf("Running {i}", running); */
-            (*scheduled[running++])();
+        run_bottom_halves();
+
+        if (dropped != reported_dropped) {
+            kprintlnf("Run queue full, {u} tasks dropped", dropped - reported_dropped);
+            reported_dropped = dropped;
+        }
+
+        reap_threads();
+
+        /* Tasks first, then coroutines, then other threads, and only halt if there's none of them */
+        schedulable task = next_task();
+        if (task != NULL) {
+            set_idle(false);
+            TRACE(TRACE_DISPATCH, task, 0);
+            (*task)();
+            TRACE(TRACE_DISPATCH_END, task, 0);
+        } else if (coroutines_ready()) {
+            set_idle(false);
+            run_coroutines();
+        } else if (!thread_yield()) {
+            set_idle(true);
+            idle_until_interrupt();
         }
     }
 }
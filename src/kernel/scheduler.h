@@ -5,8 +5,38 @@
 
 typedef action0 schedulable;
 
-void schedule(schedulable);
+/* Run queue priorities, lower runs first */
+#define PRIORITY_LEVELS 4
+#define PRIORITY_INTERACTIVE 0 /* Work scheduled in response to a key */
+#define PRIORITY_HIGH 1
+#define PRIORITY_NORMAL 2
+#define PRIORITY_BACKGROUND 3
 
+bool schedule(schedulable);
+bool schedule_at(schedulable, int priority);
+bool set_interactive(bool now_interactive);
+
+/* Bottom halves: deferred work raised from interrupt handlers, run from the main loop */
+#define MAX_BOTTOM_HALVES 32
+
+int register_bottom_half(schedulable bottom_half);
+void raise_bottom_half(int id);
+void run_bottom_halves();
+
+/* Every timer tick is charged to busy or idle, depending on what the CPU was doing */
+typedef struct SchedulerStats {
+    uint32_t busy_ticks;
+    uint32_t idle_ticks;
+    uint32_t queued;
+    uint32_t dropped; /* Tasks that didn't fit in the run queue */
+} scheduler_stats;
+
+bool set_idle(bool now_idle);
+bool is_idle();
+void account_ticks(uint32_t ticks);
+scheduler_stats get_scheduler_stats();
+
+void idle_until_interrupt();
 void run_scheduler();
 void stop();
 
@@ -1,23 +1,53 @@
 #include "shell.h"
+#include "../cpu/clock.h"
 #include "../cpu/info.h"
+#include "../cpu/isr.h"
+#include "../cpu/smp.h"
 #include "../cpu/timer.h"
 #include "../cpu/types.h"
+#include "../drivers/debugcon.h"
 #include "../drivers/keyboard.h"
 #include "../drivers/screen.h"
 #include "../libc/function.h"
+#include "../libc/histogram.h"
+#include "../libc/irqsoff.h"
+#include "../libc/lock.h"
 #include "../libc/mem.h"
+#include "../libc/perfecthash.h"
 #include "../libc/string.h"
-/* #include "program.h" */
+#include "../libc/trace.h"
+#include "bench.h"
+#include "coroutine.h"
+#include "instrument.h"
+#include "lineedit.h"
+#include "pacer.h"
+#include "pipe.h"
+#include "profile.h"
+#include "program.h"
+#include "replay.h"
 #include "scheduler.h"
+#include "thread.h"
+#include "top.h"
 #include "visualise.h"
+#include "workqueue.h"
+
+/* Arguments are split on spaces, each one a slice straight into the line buffer */
+#define MAX_ARGUMENTS 16
+
+typedef struct Arguments {
+    int count;
+    slice values[MAX_ARGUMENTS];
+    slice piped; /* Output of the command before it in the pipeline, start is NULL for the first */
+} arguments;
 
 typedef struct Command {
     const char *key;
-    void (*func)(const char *input);
+    void (*func)(const char *input, const arguments *args);
     const char *help;
 } command;
 
-#define CMD(name) void cmd_##name(const char *input)
+/* 'input' is everything after the command name, 'args' is the same thing split up */
+#define CMD(name) void cmd_##name(const char *input, const arguments *args)
 #define CMDREF(name, help) \
     { #name, cmd_##name, help }
 
@@ -25,13 +55,35 @@ CMD(end);
 CMD(uptime);
 CMD(neofetch);
 CMD(test);
-/* CMD(program); */
+CMD(program);
 CMD(visualise);
+CMD(top);
+CMD(frames);
+CMD(threads);
 CMD(memory);
 CMD(memory_info);
 CMD(memory_map);
 CMD(cpuid);
+CMD(smp);
+CMD(tickless);
+CMD(profile);
+CMD(instrument);
+CMD(trace);
+CMD(irqsoff);
+CMD(locks);
+CMD(keyboard);
+CMD(latency);
+CMD(busy);
+CMD(record);
+CMD(replay);
+CMD(bench);
 CMD(colors);
+CMD(grep);
+CMD(count);
+CMD(head);
+CMD(cat);
+CMD(repeat);
+CMD(time);
 CMD(help);
 CMD(echo);
 CMD(clear);
@@ -41,18 +93,46 @@ const command commands[] = {
     CMDREF(uptime, "Prints the current uptime"),
     CMDREF(neofetch, "A nerd's calling card"),
     CMDREF(test, "Runs whatever test code is currently in place"),
-    /* CMDREF(program, "Runs the program"), */
+    CMDREF(program, "Runs the program"),
     CMDREF(visualise, "Runs the visualiser"),
+    CMDREF(top, "Shows CPU, run queue, heap and interrupt activity, refreshed every second"),
+    CMDREF(frames, "Prints frame pacing statistics for the animated programs, against their frame budgets"),
+    CMDREF(threads, "Lists the kernel threads and coroutines, with context switch counts and cost"),
     CMDREF(memory, "Prints out the current status and a map of main memory"),
     CMDREF(memory_info, "Prints out the current status of main memory"),
     CMDREF(memory_map, "Prints out a map of main memory"),
     CMDREF(cpuid, "Prints out information about the CPU"),
+    CMDREF(locks, "Prints acquisitions, contention and hold times for each lock, 'locks reset' clears them"),
+    CMDREF(smp, "Lists the CPUs and the work each has run, 'smp bench' times a parallel workload on 1 to all of them"),
+    CMDREF(profile, "Samples where the CPU is: 'profile start [ticks]', 'stop', 'report [N]', 'export'"),
+    CMDREF(instrument, "Counts cycles per function in INSTRUMENT builds: 'instrument start', 'stop', 'report [N]'"),
+    CMDREF(trace, "Records tracepoints, 'trace start [irq schedule heap key]', 'stop', or 'dump' to the debug port"),
+    CMDREF(irqsoff, "Times interrupts-off windows and PIT jitter, 'irqsoff start' or 'stop', then 'irqsoff' to see"),
+    CMDREF(tickless, "'tickless on|off' switches to APIC one-shots and back, 'tickless measure' counts idle IRQs"),
+    CMDREF(keyboard, "Prints out keyboard interrupt statistics"),
+    CMDREF(latency, "Prints keystroke to echo and Enter to dispatch latency, 'latency reset' clears them"),
+    CMDREF(busy, "Runs a CPU-bound background job, 'busy seconds [priority]', 0 is the highest of 4"),
+    CMDREF(record, "Records keyboard input, 'record start' or 'record stop'"),
+    CMDREF(replay, "Replays the recording, 'replay fast' skips the pauses, 'replay bench N' types a script N times"),
+    CMDREF(bench, "Runs the benchmarks, 'bench <pattern>' only runs the ones with it in their name"),
     CMDREF(colors, "Prints out all of the colors, with color codes"),
-    CMDREF(help, "Prints a list of commands with help text"),
+    CMDREF(grep, "Prints the piped in lines containing the input, e.g. 'help | grep memory'"),
+    CMDREF(count, "Counts the lines, words and bytes piped in"),
+    CMDREF(head, "Prints the first N (default 10) piped in lines"),
+    CMDREF(cat, "Prints the buffer output was sent to with '> name', or lists them"),
+    CMDREF(repeat, "Runs a command N times, 'repeat N command'"),
+    CMDREF(time, "Runs a command and prints how long it took, 'time command'"),
+    CMDREF(help, "Prints a list of commands with help text, 'help <prefix>' only lists matching ones"),
     CMDREF(echo, "Echos the input back to you"),
     CMDREF(clear, "Clears the screen"),
 };
 
+/* Long-running programs get their own thread, so the shell keeps going alongside them */
+static void start_thread(const char *name, action0 entry) {
+    if (thread_create(name, entry) == NULL)
+        kprintln("Not enough memory for another thread");
+}
+
 CMD(end) {
     UNUSED(input);
     kprint("Exiting. Bye!\n");
@@ -62,12 +142,12 @@ CMD(end) {
 CMD(uptime) {
     UNUSED(input);
 
-    kprintlnf("Uptime: {i} seconds", get_tick() / 1000);
+    uint32_t ms = (uint32_t)(clock_ns() / 1000000);
+    kprintlnf("Uptime: {u}.{u}{u}{u} seconds", ms / 1000, ms / 100 % 10, ms / 10 % 10, ms % 10);
 }
 
 CMD(neofetch) {
     UNUSED(input);
-    cpu_information cpu = cpu_info();
     memory_info mem = mem_info();
 
     // clang-format off
@@ -77,7 +157,7 @@ CMD(neofetch) {
     kprintlnf("MMMN0Okkl'.'kWWXK0000KXWMWx'...lkkk0XWMM   An OS by Infinidoge");
     kprintlnf("MWXOkkkd,...lOxlccccccox0O;....'okkkOXWM");
     kprintlnf("WXOkkkd;....'cccccccccccl;......,dkkkOKW   Hardware: QEMU VM");
-    kprintlnf("XOkkkd;......;::cccccccc:,.......;dkkkOX   - CPU: {i} core Intel Pentium II(-ish)", cpu.maximum_logical_processors);
+    kprintlnf("XOkkkd;......;::cccccccc:,.......;dkkkOX   - CPU: {i} core Intel Pentium II(-ish)", online_cpus());
     kprintlnf("Kkkkd;.....',,,;::cccccc:;,'......,okkkK   - Memory: {i}kb/{i}kb", mem.allocated / 1024, mem.physical / 1024);
     kprintlnf("Kkxl,...',::::;;,;::ccc:;;:::;,'...'cxkK   - Resolution: 80x25 characters");
     kprintlnf("Nkc''',cooolloooc;,;:::cloolloool;''':kN");
@@ -87,7 +167,8 @@ CMD(neofetch) {
     kprintlnf("MMMMMXOxl:,,,,,:oxdoodxdc;,,,,;:lddlclOW   Disks:");
     kprintlnf("MMMMMWNKOdlccloooc:;;:cloolccclddocccl0M   - None (yet) :)");
     kprintlnf("MMMMMMMWNXK0xlc:;,,,,,,,;cloooollccccdXM");
-    kprintlnf("MMMMMMMMMMMWKd;,,,,,,,,,,;;:ccccccccckNM   Uptime: {i} seconds", get_tick() / 1000);
+    kprintlnf("MMMMMMMMMMMWKd;,,,,,,,,,,;;:ccccccccckNM   Uptime: {u} seconds",
+        (uint32_t)(clock_ns() / 1000000000));
     kprintlnf("MMMMMMMMMMMMMNkc,,'''',,;:ccccccccccoKWM");
     kprintlnf("MMMMMMMMMMMMMMW0c......;:cccccccccclOWMM");
     kprintlnf("MMMMMMMMMMMMMMMMKdc::cxOdccccccccclkNMMM");
@@ -102,10 +183,11 @@ CMD(test) {
     UNUSED(input);
 }
 
-/* CMD(program) { */
-/*     UNUSED(input); */
-/*     schedule(&program); */
-/* } */
+CMD(program) {
+    UNUSED(input);
+    if (!program())
+        kprintln("The program is already running");
+}
 
 CMD(visualise) {
     if (strcmp(input, "bubble") == 0)
@@ -119,7 +201,24 @@ CMD(visualise) {
     else
         algorithm = BUBBLE;
 
-    schedule(&visualiser);
+    start_thread("visualise", &visualiser);
+}
+
+CMD(top) {
+    UNUSED(input);
+    start_thread("top", &top);
+}
+
+CMD(frames) {
+    UNUSED(input);
+    print_pacers();
+}
+
+CMD(threads) {
+    UNUSED(input);
+    print_threads();
+    kprintln("");
+    print_coroutines();
 }
 
 CMD(memory) {
@@ -192,6 +291,262 @@ CMD(cpuid) {
     }
 }
 
+CMD(smp) {
+    UNUSED(input);
+    if (args->count > 0 && slice_equals(args->values[0], "bench")) {
+        run_scaling_benchmark();
+        return;
+    }
+
+    print_cpus();
+    print_work_stats();
+}
+
+static uint32_t total_interrupts() {
+    uint32_t total = 0;
+    for (int i = IRQ0; i <= IRQ16; i++)
+        total += interrupt_counts[i];
+    return total;
+}
+
+/* Idles for a second and counts the interrupts that took */
+static void measure_idle_interrupts() {
+    uint32_t before = total_interrupts();
+    uint32_t timer_before = interrupt_counts[IRQ0] + interrupt_counts[IRQ16];
+    sleep(1000);
+    uint32_t count = total_interrupts() - before;
+    uint32_t timer_count = interrupt_counts[IRQ0] + interrupt_counts[IRQ16] - timer_before;
+
+    const char *mode = is_tickless() ? "tickless" : "periodic";
+    kprintlnf("{}: {u} interrupts in a second idle, {u} of them the timer", mode, count, timer_count);
+
+    debug_print("{\"bench\":\"idle_interrupts\",\"mode\":\"");
+    debug_print(mode);
+    debug_print("\",\"interrupts\":");
+    debug_print_uint(count);
+    debug_print(",\"timer\":");
+    debug_print_uint(timer_count);
+    debug_print(",\"unit\":\"per_second\"}\n");
+}
+
+CMD(tickless) {
+    if (strcmp(input, "measure") == 0) {
+        measure_idle_interrupts();
+        return;
+    }
+
+    if (strcmp(input, "on") == 0 || strcmp(input, "off") == 0) {
+        if (!set_tickless(strcmp(input, "on") == 0))
+            kprintln("No local APIC timer to go tickless with");
+    }
+
+    kprintlnf("Timer: {}", is_tickless() ? "tickless, local APIC one-shots" : "periodic, PIT at 1kHz");
+}
+
+CMD(profile) {
+    if (args->count == 0) {
+        kprintln("profile start [ticks] | stop | report [N] | export");
+        return;
+    }
+
+    slice action = args->values[0];
+    if (slice_equals(action, "start")) {
+        profile_start(args->count > 1 ? ascii_to_int(args->values[1].start) : 1);
+    } else if (slice_equals(action, "stop")) {
+        profile_stop();
+    } else if (slice_equals(action, "report")) {
+        profile_report(args->count > 1 ? ascii_to_int(args->values[1].start) : 15);
+    } else if (slice_equals(action, "export")) {
+        profile_export();
+    } else {
+        kprintln("profile start [ticks] | stop | report [N] | export");
+    }
+}
+
+CMD(instrument) {
+    if (args->count == 0) {
+        kprintln("instrument start | stop | report [N]");
+        return;
+    }
+
+    slice action = args->values[0];
+    if (slice_equals(action, "start")) {
+        instrument_start();
+    } else if (slice_equals(action, "stop")) {
+        instrument_stop();
+    } else if (slice_equals(action, "report")) {
+        instrument_report(args->count > 1 ? ascii_to_int(args->values[1].start) : 15);
+    } else {
+        kprintln("instrument start | stop | report [N]");
+    }
+}
+
+CMD(trace) {
+    if (args->count == 0) {
+        print_trace_status();
+        return;
+    }
+
+    slice action = args->values[0];
+    if (slice_equals(action, "start")) {
+        uint32_t events = 0;
+        for (int i = 1; i < args->count; i++) {
+            uint32_t group = trace_group(args->values[i]);
+            if (group == 0) {
+                kprintln("Groups are irq, schedule, heap and key");
+                return;
+            }
+            events |= group;
+        }
+        if (!trace_start(events != 0 ? events : ~0u))
+            kprintln("Not enough memory to trace");
+    } else if (slice_equals(action, "stop")) {
+        trace_stop();
+    } else if (slice_equals(action, "dump")) {
+        trace_dump();
+    } else {
+        kprintln("trace [start [groups] | stop | dump]");
+    }
+}
+
+CMD(irqsoff) {
+    if (strcmp(input, "start") == 0)
+        irqsoff_start();
+    else if (strcmp(input, "stop") == 0)
+        irqsoff_stop();
+    else
+        print_irqsoff();
+}
+
+CMD(locks) {
+    if (strcmp(input, "reset") == 0) {
+        reset_lock_stats();
+        return;
+    }
+
+    print_lock_stats();
+}
+
+CMD(keyboard) {
+    UNUSED(input);
+    keyboard_stats stats = get_keyboard_stats();
+
+    kprintlnf("IRQs: {u}", stats.irqs);
+    kprintlnf("Scancodes: {u}", stats.scancodes);
+    kprintlnf("Ring overflows: {u}", stats.overflows);
+    kprintlnf("Cycles in IRQ: {u} average, {u} max",
+        stats.irqs ? (uint32_t)(stats.irq_cycles / stats.irqs) : 0, stats.max_irq_cycles);
+}
+
+/* Cycles from the keyboard IRQ reading a key to its echo landing in video memory */
+static histogram echo_latency;
+
+/* Cycles from the keyboard IRQ reading Enter to the shell starting on the line, time in the run queue included */
+static histogram dispatch_latency;
+static uint32_t submitted_timestamp;
+
+static void print_latency(const char *what, const char *unit, const histogram *latency) {
+    kprintlnf("{} latency over {u} {}, in cycles: {u} p50, {u} p99, {u} max", what, latency->count, unit,
+        histogram_percentile(latency, 50), histogram_percentile(latency, 99), latency->max);
+}
+
+CMD(latency) {
+    if (strcmp(input, "reset") == 0) {
+        histogram_reset(&echo_latency);
+        histogram_reset(&dispatch_latency);
+        return;
+    }
+
+    print_latency("Keystroke to echo", "keys", &echo_latency);
+    print_histogram(&echo_latency);
+    print_latency("Enter to dispatch", "lines", &dispatch_latency);
+}
+
+/* A CPU-bound background job, as load to measure the shell's responsiveness against */
+#define BUSY_BACKLOG 16 /* Chunks it keeps queued, like a batch of work items */
+
+static struct {
+    uint32_t end_tick;
+    int priority;
+    int outstanding;
+    uint32_t chunks;
+} busy_job;
+
+/**
+ * Spins for a tick, then queues itself again until the job's time is up
+ * The last chunk to finish reports how long the shell took to get to lines entered meanwhile
+ */
+static void busy_chunk() {
+    uint32_t start = get_tick();
+    while (get_tick() == start)
+        ;
+    busy_job.chunks++;
+
+    if ((int32_t)(get_tick() - busy_job.end_tick) < 0 && schedule_at(&busy_chunk, busy_job.priority))
+        return;
+
+    if (--busy_job.outstanding == 0) {
+        kprintlnf("Busy job done after {u} chunks at priority {i}", busy_job.chunks, busy_job.priority);
+        print_latency("Enter to dispatch", "lines", &dispatch_latency);
+    }
+}
+
+CMD(busy) {
+    if (busy_job.outstanding > 0) {
+        kprintln("A busy job is already running");
+        return;
+    }
+
+    int priority = args->count > 1 ? ascii_to_int(args->values[1].start) : PRIORITY_BACKGROUND;
+    if (args->count == 0 || priority < 0 || priority >= PRIORITY_LEVELS) {
+        kprintln("Usage: busy seconds [priority]");
+        return;
+    }
+
+    busy_job.end_tick = get_tick() + ascii_to_int(args->values[0].start) * 1000;
+    busy_job.priority = priority;
+    busy_job.chunks = 0;
+    histogram_reset(&dispatch_latency);
+
+    for (int i = 0; i < BUSY_BACKLOG; i++) {
+        if (schedule_at(&busy_chunk, priority))
+            busy_job.outstanding++;
+    }
+}
+
+CMD(record) {
+    if (strcmp(input, "start") == 0)
+        record_start();
+    else if (strcmp(input, "stop") == 0)
+        record_stop();
+    else
+        kprintln("Usage: record start|stop");
+}
+
+CMD(replay) {
+    if (args->count == 0) {
+        replay_recording(false);
+    } else if (slice_equals(args->values[0], "fast")) {
+        replay_recording(true);
+    } else if (slice_equals(args->values[0], "mark")) {
+        replay_mark();
+    } else if (slice_equals(args->values[0], "bench")) {
+        int repetitions = args->count > 1 ? ascii_to_int(args->values[1].start) : 1;
+        if (repetitions < 0)
+            kprintln("Usage: replay bench N, where N isn't negative");
+        else
+            replay_script(repetitions);
+    } else {
+        kprintln("Usage: replay [fast|bench N]");
+    }
+}
+
+CMD(bench) {
+    UNUSED(args);
+    if (run_benchmarks(input) == 0)
+        kprintlnf("No benchmarks match '{}'", input);
+}
+
 CMD(colors) {
     UNUSED(input);
     for (int i = 0; i < 16; i++) {
@@ -199,11 +554,172 @@ CMD(colors) {
     }
 }
 
-CMD(help) {
+/////////// Pipeline commands //////////
+
+CMD(grep) {
+    slice pattern = {input, strlen(input)};
+    slice text = args->piped, line;
+
+    while (slice_next_line(&text, &line)) {
+        if (slice_contains(line, pattern)) {
+            kprint_slice(line);
+            kprint("\n");
+        }
+    }
+}
+
+CMD(count) {
     UNUSED(input);
+    slice text = args->piped, line;
+    uint32_t lines = 0, words = 0;
+
+    while (slice_next_line(&text, &line)) {
+        lines++;
+        for (int i = 0; i < line.length; i++) {
+            if (line.start[i] != ' ' && (i == 0 || line.start[i - 1] == ' '))
+                words++;
+        }
+    }
+
+    kprintlnf("{u} lines, {u} words, {u} bytes", lines, words, args->piped.length);
+}
+
+CMD(head) {
+    int lines = args->count > 0 ? ascii_to_int(args->values[0].start) : 10;
+    slice text = args->piped, line;
+
+    while (lines-- > 0 && slice_next_line(&text, &line)) {
+        kprint_slice(line);
+        kprint("\n");
+    }
+}
+
+CMD(cat) {
+    if (args->count == 0) {
+        list_named_buffers();
+        return;
+    }
+
+    pipe_buffer *buffer = named_buffer(args->values[0], false);
+    if (buffer == NULL)
+        kprintlnf("No buffer called {}", input);
+    else
+        kprint_slice(pipe_contents(buffer));
+}
+
+/////////// Scripting //////////
+
+/* run_line cuts its line up, so each run gets a fresh copy */
+static bool run_copy(const char *line) {
+    char copy[LINE_MAX];
+    int length = strlen(line);
+    if (length >= LINE_MAX)
+        return false;
+
+    memory_copy((uint8_t *)line, (uint8_t *)copy, length + 1);
+    return run_line(copy);
+}
+
+CMD(repeat) {
+    if (args->count < 2) {
+        kprintln("Usage: repeat N command");
+        return;
+    }
+
+    int times = ascii_to_int(args->values[0].start);
+    for (int i = 0; i < times; i++) {
+        if (!run_copy(args->values[1].start))
+            return;
+    }
+}
+
+CMD(time) {
+    uint64_t start_ns = clock_ns();
+    uint64_t start = clock_cycles();
+
+    run_copy(input);
+
+    uint64_t cycles = clock_cycles() - start;
+    kprintlnf("time: {u} us, {u} kcycles", (uint32_t)((clock_ns() - start_ns) / 1000), (uint32_t)(cycles / 1000));
+}
+
+/////////// Command table //////////
+
+/* Exact names go through a perfect hash, so dispatch is one probe however many commands there are
+ * (or a scan of the table, if the hash couldn't be built)
+ * Prefixes (completion, 'help <prefix>') go through an index of the commands sorted by name */
+static perfect_hash command_names;
+static bool command_names_hashed = false;
+static uint16_t sorted_commands[LEN(commands)];
+
+static void build_command_table() {
+    command_names_hashed = phash_build(&command_names, &commands[0].key, sizeof(command), LEN(commands));
+    if (!command_names_hashed)
+        kprintln("ERROR: couldn't hash the command names, looking them up one by one");
+
+    /* Insertion sort, it only happens once */
+    for (size_t i = 0; i < LEN(commands); i++) {
+        int j = i;
+        while (j > 0 && strcmp(commands[sorted_commands[j - 1]].key, commands[i].key) > 0) {
+            sorted_commands[j] = sorted_commands[j - 1];
+            j--;
+        }
+        sorted_commands[j] = i;
+    }
+}
+
+static const command *find_command(slice name) {
+    if (!command_names_hashed) {
+        for (size_t i = 0; i < LEN(commands); i++) {
+            if (slice_equals(name, commands[i].key))
+                return &commands[i];
+        }
+        return NULL;
+    }
+
+    int index = phash_lookup(&command_names, name.start, name.length);
+    return index < 0 ? NULL : &commands[index];
+}
+
+/**
+ * Finds the range of sorted_commands whose names start with the prefix
+ * Returns the number of matches, the first of which is at *first
+ */
+static int find_prefix(slice prefix, int *first) {
+    int total = LEN(commands);
+
+    /* Lower bound: the first name that isn't less than the prefix */
+    int low = 0, high = total;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (strncmp(commands[sorted_commands[middle]].key, prefix.start, prefix.length) < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    *first = low;
+
+    int count = 0;
+    while (low + count < total
+        && strncmp(commands[sorted_commands[low + count]].key, prefix.start, prefix.length) == 0)
+        count++;
+
+    return count;
+}
+
+CMD(help) {
+    slice prefix = {"", 0};
+    if (args->count > 0)
+        prefix = args->values[0];
+
+    int first;
+    int count = find_prefix(prefix, &first);
+
     kprint("----- HELP -----\n");
-    for (int i = 0; i < LEN(commands); i++) {
-        kprintf("{}: {}\n", commands[i].key, commands[i].help);
+    for (int i = first; i < first + count; i++) {
+        const command *cmd = &commands[sorted_commands[i]];
+        kprintf("{}: {}\n", cmd->key, cmd->help);
     }
     kprint("\n");
 }
@@ -216,65 +732,237 @@ CMD(clear) {
     clear_screen();
 }
 
-static char key_buffer[256];
+static line_editor editor;
+static char *submitted_line;
+
+/**
+ * Splits the line into slices of the line buffer, no copying
+ */
+static void split_arguments(const char *line, arguments *args) {
+    args->count = 0;
+
+    int i = 0;
+    while (line[i] != '\0' && args->count < MAX_ARGUMENTS) {
+        while (line[i] == ' ')
+            i++;
+        if (line[i] == '\0')
+            break;
+
+        slice *arg = &args->values[args->count++];
+        arg->start = &line[i];
+        while (line[i] != ' ' && line[i] != '\0')
+            i++;
+        arg->length = &line[i] - arg->start;
+    }
+}
+
+/**
+ * Cuts trailing spaces off by terminating the string early
+ */
+static void trim_end(char *text) {
+    int length = strlen(text);
+    while (length > 0 && text[length - 1] == ' ')
+        text[--length] = '\0';
+}
+
+/**
+ * Looks up and runs one command, 'line' being its name followed by its input
+ * Returns false if the name isn't a command, leaving it in 'name'
+ */
+static bool run_command(const char *line, slice piped, slice *name) {
+    while (*line == ' ')
+        line++;
+
+    name->start = line;
+    name->length = 0;
+    while (line[name->length] != ' ' && line[name->length] != '\0')
+        name->length++;
+
+    if (name->length == 0)
+        return true;
+
+    const command *cmd = find_command(*name);
+    if (cmd == NULL)
+        return false;
+
+    const char *input = line[name->length] == ' ' ? &line[name->length + 1] : "";
+
+    arguments args;
+    split_arguments(input, &args);
+    args.piped = piped;
+    cmd->func(input, &args);
+    return true;
+}
 
-static void user_input() {
-    bool found = false;
-    for (int i = 0; i < LEN(commands); i++) {
-        int last;
-        const command *cmd = &commands[i];
-        if (strbeginswith(key_buffer, cmd->key, &last)) {
-            if (key_buffer[last] == ' ') {
-                cmd->func(&key_buffer[last + 1]);
-                found = true;
-            } else if (key_buffer[last] == '\0') {
-                cmd->func("");
-                found = true;
+/* Stages of a pipeline alternate between the two buffers, reading one while writing the other,
+ * so every command's piped input is one contiguous slice that never needs copying */
+#define MAX_STAGES 8
+static pipe_buffer stage_buffers[2];
+
+/**
+ * Runs 'cmd1 | cmd2 | ... > name', cutting the line up in place
+ * Only the last stage prints to the screen, and not even that if its output is redirected
+ * Returns false if the line couldn't be run
+ */
+bool run_line(char *line) {
+    char *stages[MAX_STAGES];
+    int count = 0;
+    char *redirect = NULL;
+
+    stages[count++] = line;
+    for (char *c = line; *c != '\0'; c++) {
+        if (*c == '|') {
+            if (count == MAX_STAGES) {
+                kprintlnf("At most {i} commands can be piped together", MAX_STAGES);
+                return false;
             }
+            *c = '\0';
+            stages[count++] = c + 1;
+        } else if (*c == '>') {
+            *c = '\0';
+            redirect = c + 1;
+            break;
         }
     }
 
-    key_buffer[0] = '\0';
+    pipe_buffer *target = NULL;
+    if (redirect != NULL) {
+        while (*redirect == ' ')
+            redirect++;
+        slice name = {redirect, 0};
+        while (redirect[name.length] != ' ' && redirect[name.length] != '\0')
+            name.length++;
+
+        target = named_buffer(name, true);
+        if (target == NULL) {
+            kprintlnf("Can't redirect into that, names are 1 to {i} characters and there can be {i} buffers",
+                BUFFER_NAME_MAX - 1, MAX_NAMED_BUFFERS);
+            return false;
+        }
+    }
+
+    slice piped = {NULL, 0};
+    for (int i = 0; i < count; i++) {
+        pipe_buffer *output = i < count - 1 ? &stage_buffers[i % 2] : target;
+        trim_end(stages[i]);
 
-    if (!found)
-        kprintln("Invalid command.");
+        if (output != NULL && !capture_output(output)) {
+            kprintlnf("Not enough memory to capture the output of '{}'", stages[i]);
+            return false;
+        }
+        slice name;
+        bool valid = run_command(stages[i], piped, &name);
+        if (output != NULL)
+            release_output();
+
+        if (!valid) {
+            kprint("Invalid command: ");
+            kprint_slice(name);
+            kprint("\n");
+            return false;
+        }
 
-    schedule(&print_prompt);
+        if (output != NULL) {
+            if (output->truncated)
+                kprintlnf("Output of '{}' was cut off at {i} bytes", stages[i], PIPE_BUFFER_SIZE - 1);
+            piped = pipe_contents(output);
+        }
+    }
+
+    return true;
 }
 
-static void shell_key_handler(uint8_t scancode) {
-    static bool next_upper = false;
+/**
+ * Runs the submitted line, then gives the keyboard back for the next one
+ * Key events stay paused until now, so keys typed while a command runs land on the next prompt
+ */
+static void user_input() {
+    histogram_add(&dispatch_latency, (uint32_t)rdtsc() - submitted_timestamp);
+    run_line(submitted_line);
 
-    bool KEY_BUFFER_EMPTY = key_buffer[0] == '\0';
+    line_clear(&editor);
+    print_prompt();
+    line_show(&editor);
+    resume_key_events();
+}
 
-    if (scancode == BACKSPACE) {
-        if (!KEY_BUFFER_EMPTY) {
-            backspace(key_buffer);
-            kprint_backspace();
-        }
-    } else if (scancode == ENTER) {
+/**
+ * Completes the command name being typed
+ * A single match is filled in, several are filled in as far as they agree and listed if that isn't any further
+ */
+static void complete_command() {
+    if (!line_cursor_at_end(&editor))
+        return;
+
+    /* With the cursor at the end the gap is too, so the text is all at the start of the buffer */
+    slice prefix = {editor.buffer, line_length(&editor)};
+    for (int i = 0; i < prefix.length; i++) {
+        if (prefix.start[i] == ' ')
+            return; /* Only the command name completes */
+    }
+
+    int first;
+    int count = find_prefix(prefix, &first);
+    if (count == 0)
+        return;
+
+    /* Longest prefix every match shares */
+    const char *match = commands[sorted_commands[first]].key;
+    int common = strlen(match);
+    for (int i = first + 1; i < first + count; i++) {
+        const char *other = commands[sorted_commands[i]].key;
+        int j = prefix.length;
+        while (j < common && match[j] == other[j])
+            j++;
+        common = j;
+    }
+
+    if (common > prefix.length) {
+        for (int i = prefix.length; i < common; i++)
+            line_insert(&editor, match[i]);
+
+        if (count == 1)
+            line_insert(&editor, ' ');
+    } else if (count > 1) {
         kprint("\n");
-        schedule(&user_input);
-    } else if (scancode == LSHIFT || scancode == RSHIFT) {
-        next_upper = true;
-    } else {
-        char letter = get_letter(scancode, next_upper);
-        if (next_upper)
-            next_upper = false;
+        for (int i = first; i < first + count; i++)
+            kprintf("{}  ", commands[sorted_commands[i]].key);
+        kprint("\n");
+        print_prompt();
+        line_show(&editor);
+    }
+}
+
+static void shell_key_handler(key_event event) {
+    if (!KEY_PRESSED(event))
+        return;
 
-        /* Remember that kprint only accepts char[] */
-        char str[2] = {letter, '\0'};
-        append(key_buffer, letter);
-        kprint(str);
+    if (event.keycode == KEY_ENTER || event.keycode == KEY_KEYPAD_ENTER) {
+        submitted_line = line_submit(&editor);
+        submitted_timestamp = event.timestamp;
+        kprint("\n");
+        pause_key_events();
+        schedule(&user_input);
+    } else if (event.keycode == KEY_TAB) {
+        complete_command();
+    } else if (line_edit_key(&editor, event)) {
+        return;
+    } else if (event.ascii >= ' ') {
+        if (line_insert(&editor, event.ascii))
+            histogram_add(&echo_latency, (uint32_t)rdtsc() - event.timestamp);
     }
 }
 
 void init_shell() {
+    build_command_table();
+
     kprintln("Type something, it will go through the kernel");
     kprintln("Type help for a list of commands");
     kprintln("Type end to exit");
 
+    line_init(&editor);
     print_prompt();
+    line_show(&editor);
 
-    key_handler = &shell_key_handler;
+    swap_key_handler(&shell_key_handler);
 }
@@ -1,8 +1,11 @@
 #ifndef SHELL_H_
 #define SHELL_H_
 
+#include "../cpu/types.h"
+
 #define LEN(array) (sizeof(array) / sizeof(array[0]))
 
 void init_shell();
+bool run_line(char *line);
 
 #endif // SHELL_H_
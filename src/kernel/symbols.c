@@ -0,0 +1,29 @@
+#include "symbols.h"
+
+/* The end of the kernel's code, from the linker */
+extern const char etext[];
+
+/**
+ * Finds the function an address is in, by binary search for the last symbol at or before it
+ * Returns its index in kernel_symbols, or -1 if it isn't in the kernel's code
+ */
+int find_symbol(uint32_t address) {
+    if (kernel_symbol_count == 0 || address < kernel_symbols[0].address || address >= (uint32_t)etext)
+        return -1;
+
+    uint32_t low = 0, high = kernel_symbol_count - 1;
+    while (low < high) {
+        uint32_t middle = (low + high + 1) / 2;
+        if (kernel_symbols[middle].address <= address)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    return low;
+}
+
+/* The name of the function an address is in, "?" if there isn't one */
+const char *symbol_name(uint32_t address) {
+    int index = find_symbol(address);
+    return index < 0 ? "?" : kernel_symbols[index].name;
+}
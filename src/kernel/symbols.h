@@ -0,0 +1,22 @@
+#ifndef SYMBOLS_H_
+#define SYMBOLS_H_
+
+#include "../cpu/types.h"
+
+/* The kernel's own function symbols, sorted by address
+ *
+ * The build links the kernel once against an empty table, pulls the function symbols out of that with nm,
+ * and links it again with them in kernel_symbols.c (see the Makefile). The table is all read-only data,
+ * which goes after every function, so the second link doesn't move any of them. */
+typedef struct KernelSymbol {
+    uint32_t address;
+    const char *name;
+} kernel_symbol;
+
+extern const kernel_symbol kernel_symbols[];
+extern const uint32_t kernel_symbol_count;
+
+int find_symbol(uint32_t address);
+const char *symbol_name(uint32_t address);
+
+#endif // SYMBOLS_H_
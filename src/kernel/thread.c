@@ -0,0 +1,314 @@
+#include "thread.h"
+#include "../cpu/info.h"
+#include "../cpu/timer.h"
+#include "../drivers/screen.h"
+#include "../libc/atomic.h"
+#include "../libc/histogram.h"
+#include "../libc/mem.h"
+#include "scheduler.h"
+
+/**
+ * void switch_context(uint32_t **save_esp, uint32_t *load_esp)
+ * Pushes the callee-saved registers and flags, saves the stack pointer, then pops the same off the other stack
+ * Interrupts have to be off on the way in, each thread gets its own flags back on the way out
+ */
+void switch_context(uint32_t **save_esp, uint32_t *load_esp);
+asm(".global switch_context\n"
+    "switch_context:\n"
+    "    push %ebp\n"
+    "    push %ebx\n"
+    "    push %esi\n"
+    "    push %edi\n"
+    "    pushf\n"
+    "    mov 24(%esp), %eax\n" // save_esp, past the five pushes and the return address
+    "    mov 28(%esp), %ecx\n" // load_esp
+    "    mov %esp, (%eax)\n"
+    "    mov %ecx, %esp\n"
+    "    popf\n"
+    "    pop %edi\n"
+    "    pop %esi\n"
+    "    pop %ebx\n"
+    "    pop %ebp\n"
+    "    ret\n");
+
+static thread boot_thread = {.name = "boot", .state = THREAD_RUNNING};
+static thread *current = &boot_thread;
+static thread *all_threads = &boot_thread;
+static uint32_t next_id = 1;
+static int quantum = THREAD_QUANTUM;
+
+static thread *ready_head = NULL, *ready_tail = NULL;
+static thread *dead = NULL;
+
+static uint32_t total_switches = 0;
+static uint64_t switch_started;
+static histogram switch_cycles;
+
+static void make_ready(thread *t) {
+    t->state = THREAD_READY;
+    t->next = NULL;
+    if (ready_tail == NULL)
+        ready_head = t;
+    else
+        ready_tail->next = t;
+    ready_tail = t;
+}
+
+/* The wake timer's function, from the timer IRQ */
+static void wake_thread(void *data) {
+    thread_wake((thread *)data);
+}
+
+/* Called first thing by whichever thread a switch lands in */
+static void finish_switch() {
+    histogram_add(&switch_cycles, (uint32_t)(rdtsc() - switch_started));
+}
+
+/**
+ * Switches to the next ready thread, putting the current one back in line if it's still running
+ * Interrupts have to be off
+ * Returns false if there was nothing else to run
+ */
+static bool switch_to_next() {
+    thread *next = ready_head;
+    if (next == NULL)
+        return false;
+
+    ready_head = next->next;
+    if (ready_head == NULL)
+        ready_tail = NULL;
+
+    thread *previous = current;
+    if (previous->state == THREAD_RUNNING)
+        make_ready(previous);
+
+    next->state = THREAD_RUNNING;
+    next->switches++;
+    total_switches++;
+    quantum = THREAD_QUANTUM;
+
+    previous->idle = set_idle(next->idle);
+    current = next;
+
+    switch_started = rdtsc();
+    switch_context(&previous->esp, next->esp);
+    finish_switch();
+    return true;
+}
+
+/* Where every new thread starts, still with interrupts off from the switch */
+static void thread_start() {
+    finish_switch();
+    irq_enable();
+    (*current->entry)();
+    thread_exit();
+}
+
+void init_threads() {
+    boot_thread.id = 0;
+    histogram_reset(&switch_cycles);
+}
+
+/**
+ * Makes a thread that runs 'entry' and exits when it returns
+ * It goes to the back of the ready queue, so it doesn't run until the current thread gives up the CPU
+ * Returns NULL if there isn't the memory for it
+ */
+thread *thread_create(const char *name, action0 entry) {
+    thread *t = (thread *)kmalloc(sizeof(thread));
+    uint8_t *stack = (uint8_t *)kmalloc(THREAD_STACK_SIZE);
+    if (t == NULL || stack == NULL) {
+        if (t != NULL)
+            kfree((size_t)t);
+        if (stack != NULL)
+            kfree((size_t)stack);
+        return NULL;
+    }
+
+    t->name = name;
+    t->entry = entry;
+    t->stack = stack;
+    t->idle = false;
+    t->switches = 0;
+#ifdef INSTRUMENT
+    t->shadow.generation = 0;
+#endif
+    timer_init(&t->wake, &wake_thread, t);
+
+    /* What switch_context pops: flags, edi, esi, ebx, ebp, then the return address */
+    uint32_t *esp = (uint32_t *)(stack + THREAD_STACK_SIZE);
+    *--esp = (uint32_t)&thread_start;
+    *--esp = 0; // ebp
+    *--esp = 0; // ebx
+    *--esp = 0; // esi
+    *--esp = 0; // edi
+    *--esp = 0x002; // eflags, interrupts stay off until thread_start
+    t->esp = esp;
+
+    uint32_t flags = irq_save();
+    t->id = next_id++;
+    t->next_thread = all_threads;
+    all_threads = t;
+    make_ready(t);
+    irq_restore(flags);
+
+    return t;
+}
+
+NO_INSTRUMENT thread *thread_current() {
+    return current;
+}
+
+bool thread_is_boot() {
+    return current == &boot_thread;
+}
+
+/**
+ * Gives the rest of the quantum to the next ready thread
+ * Returns false if there wasn't one, and the current thread just carries on
+ */
+bool thread_yield() {
+    uint32_t flags = irq_save();
+    bool switched = switch_to_next();
+    irq_restore(flags);
+    return switched;
+}
+
+/**
+ * Puts the boot thread at the front of the ready queue and cuts the running thread's quantum to the next tick
+ * For interrupts that leave work to a bottom half, which only the boot thread runs, so it isn't stuck
+ * behind a whole quantum of every other thread
+ */
+void thread_boost_boot() {
+    uint32_t flags = irq_save();
+    if (boot_thread.state == THREAD_READY && ready_head != &boot_thread) {
+        thread *t = ready_head;
+        while (t->next != &boot_thread)
+            t = t->next;
+        t->next = boot_thread.next;
+        if (ready_tail == &boot_thread)
+            ready_tail = t;
+
+        boot_thread.next = ready_head;
+        ready_head = &boot_thread;
+    }
+    if (boot_thread.state == THREAD_READY)
+        quantum = 1;
+    irq_restore(flags);
+}
+
+/**
+ * Takes the current thread off the CPU until at least 'ticks' ticks have passed
+ * The boot thread can't sleep, it's what runs when nothing else can
+ */
+void thread_sleep(uint32_t ticks) {
+    if (thread_is_boot())
+        return;
+
+    uint32_t flags = irq_save();
+    current->state = THREAD_SLEEPING;
+    timer_start(&current->wake, ticks, 0);
+    switch_to_next();
+    irq_restore(flags);
+}
+
+/**
+ * Takes the current thread off the CPU until thread_wake, for wait queues
+ * Interrupts have to be off, so a wakeup can't land between deciding to block and blocking
+ */
+void thread_block() {
+    if (thread_is_boot())
+        return;
+
+    current->state = THREAD_SLEEPING;
+    switch_to_next();
+}
+
+/**
+ * Makes a sleeping or blocked thread ready, cutting any sleep short
+ * Safe from interrupt handlers
+ */
+void thread_wake(thread *t) {
+    uint32_t flags = irq_save();
+    if (t->state == THREAD_SLEEPING) {
+        timer_cancel(&t->wake);
+        make_ready(t);
+    }
+    irq_restore(flags);
+}
+
+/**
+ * Ends the current thread, its stack is freed later by reap_threads
+ */
+void thread_exit() {
+    if (thread_is_boot())
+        return;
+
+    irq_disable();
+    current->state = THREAD_DEAD;
+    current->next = dead;
+    dead = current;
+    switch_to_next();
+    /* Never switched back to */
+}
+
+bool threads_ready() {
+    return ready_head != NULL;
+}
+
+/**
+ * Called from the timer IRQ, after the wheel has woken any sleepers: preempts the current thread
+ * once its quantum has run out (or straight away if it's idle) and there's someone waiting
+ */
+void thread_tick() {
+    if (--quantum <= 0 || is_idle()) {
+        quantum = THREAD_QUANTUM;
+        switch_to_next();
+    }
+}
+
+/**
+ * Frees the threads that have exited, from the boot thread where it's safe to
+ */
+void reap_threads() {
+    if (dead == NULL)
+        return;
+
+    uint32_t flags = irq_save();
+    thread *list = dead;
+    dead = NULL;
+
+    for (thread *t = list; t != NULL; t = t->next) {
+        thread **link = &all_threads;
+        while (*link != t)
+            link = &(*link)->next_thread;
+        *link = t->next_thread;
+    }
+    irq_restore(flags);
+
+    while (list != NULL) {
+        thread *next = list->next;
+        kfree((size_t)list->stack);
+        kfree((size_t)list);
+        list = next;
+    }
+}
+
+int thread_count() {
+    int count = 0;
+    for (thread *t = all_threads; t != NULL; t = t->next_thread)
+        count++;
+    return count;
+}
+
+static const char *state_names[] = {"ready", "running", "sleeping", "dead"};
+
+void print_threads() {
+    for (thread *t = all_threads; t != NULL; t = t->next_thread)
+        kprintlnf("{u} {}: {}, switched to {u} times", t->id, t->name, state_names[t->state], t->switches);
+
+    kprintlnf("Context switches: {u}", total_switches);
+    kprintlnf("Switch cost: {u} cycles p50, {u} p99, {u} max over {u} switches",
+        histogram_percentile(&switch_cycles, 50), histogram_percentile(&switch_cycles, 99), switch_cycles.max,
+        switch_cycles.count);
+}
@@ -0,0 +1,57 @@
+#ifndef THREAD_H_
+#define THREAD_H_
+
+#include "../cpu/timer.h"
+#include "../cpu/types.h"
+#include "../libc/function.h"
+#include "instrument.h"
+
+/* Preemptive kernel threads
+ *
+ * Every thread has its own stack, and the timer IRQ switches to the next ready one when the running
+ * thread's quantum runs out. The boot thread (the one running run_scheduler) is a thread too, and never
+ * sleeps or exits, so there's always something to switch to: it halts when it has nothing to do. */
+#define THREAD_STACK_SIZE 8192
+#define THREAD_QUANTUM 10 // Ticks
+
+typedef enum ThreadState {
+    THREAD_READY,
+    THREAD_RUNNING,
+    THREAD_SLEEPING,
+    THREAD_DEAD,
+} thread_state;
+
+typedef struct Thread {
+    uint32_t *esp; /* Saved stack pointer while switched out, see switch_context */
+    uint32_t id;
+    const char *name;
+    thread_state state;
+    action0 entry;
+    uint8_t *stack; /* NULL for the boot thread */
+    bool idle;      /* Whether the thread was idle when it was switched out, for tick accounting */
+    timer wake; /* Wakes the thread from thread_sleep */
+    uint32_t switches; /* Times it's been switched to */
+    struct Thread *next; /* In the ready or dead list */
+    struct Thread *next_thread; /* In the list of every thread */
+#ifdef INSTRUMENT
+    instrument_stack shadow;
+#endif
+} thread;
+
+void init_threads();
+thread *thread_create(const char *name, action0 entry);
+thread *thread_current();
+bool thread_is_boot();
+bool thread_yield();
+void thread_boost_boot();
+void thread_sleep(uint32_t ticks);
+void thread_block();
+void thread_wake(thread *t);
+void thread_exit();
+bool threads_ready();
+void thread_tick();
+void reap_threads();
+int thread_count();
+void print_threads();
+
+#endif // THREAD_H_
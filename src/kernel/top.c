@@ -0,0 +1,127 @@
+#include "top.h"
+#include "../cpu/clock.h"
+#include "../cpu/isr.h"
+#include "../cpu/timer.h"
+#include "../drivers/keyboard.h"
+#include "../drivers/screen.h"
+#include "../libc/atomic.h"
+#include "../libc/mem.h"
+#include "scheduler.h"
+#include "waitqueue.h"
+
+/* Live system monitor, refreshed once a second until a key is pressed
+ *
+ * Each frame is printed with the normal kprintf into an off-screen grid (through an output sink),
+ * then only the cells that differ from the last frame get painted. */
+
+#define REFRESH_TICKS 1000 // Roughly a second
+
+static char frame[MAX_ROWS][MAX_COLS];  /* The frame being drawn */
+static char screen[MAX_ROWS][MAX_COLS]; /* What's on the screen */
+static int frame_row, frame_col;
+
+static void frame_sink(const char *message, int length) {
+    for (int i = 0; i < length; i++) {
+        if (message[i] == '\n') {
+            frame_row++;
+            frame_col = 0;
+        } else if (frame_row < MAX_ROWS && frame_col < MAX_COLS)
+            frame[frame_row][frame_col++] = message[i];
+    }
+}
+
+static void present_frame() {
+    for (int row = 0; row < MAX_ROWS; row++) {
+        for (int col = 0; col < MAX_COLS; col++) {
+            if (frame[row][col] != screen[row][col]) {
+                paint(frame[row][col], WHITE_ON_BLACK, col, row);
+                screen[row][col] = frame[row][col];
+            }
+        }
+    }
+}
+
+static volatile bool running;
+static wait_queue key_waiters = WAIT_QUEUE_INIT;
+
+static void top_key_handler(key_event event) {
+    if (KEY_PRESSED(event)) {
+        running = false;
+        wake_up(&key_waiters);
+    }
+}
+
+static uint32_t previous_counts[256];
+static scheduler_stats previous_stats;
+
+static void draw_frame(keyhandler underneath) {
+    scheduler_stats stats = get_scheduler_stats();
+    uint32_t busy = stats.busy_ticks - previous_stats.busy_ticks;
+    uint32_t idle = stats.idle_ticks - previous_stats.idle_ticks;
+    previous_stats = stats;
+
+    memory_info mem = mem_info();
+
+    kprintlnf("top - up {u}s, any key quits", (uint32_t)(clock_ns() / 1000000000));
+    kprintln("");
+    kprintlnf("CPU:        {u}% busy ({u} busy, {u} idle ticks)", busy + idle ? busy * 100 / (busy + idle) : 0, busy,
+        idle);
+    kprintlnf("Run queue:  {u} waiting, {u} dropped since boot", stats.queued, stats.dropped);
+    kprintlnf("Heap:       {u}kb used, {u}kb free in {u} gaps, {u} allocations", mem.allocated / 1024, mem.free / 1024,
+        mem.gaps, mem.allocations);
+    /* Fragmentation: how much of the free memory isn't in the biggest gap */
+    kprintlnf("            largest gap {u}kb, {u}% fragmented", mem.largest_gap / 1024,
+        mem.free ? 100 - mem.largest_gap * 100 / mem.free : 0);
+    kprintlnf("Keys go to: {x}", (size_t)underneath);
+    kprintln("");
+    kprintln("Vector     /s      total");
+
+    for (int i = 0; i < 256; i++) {
+        uint32_t count = interrupt_counts[i];
+        if (count == 0)
+            continue;
+
+        kprintlnf("{u}         {u}      {u}", i, count - previous_counts[i], count);
+        previous_counts[i] = count;
+    }
+}
+
+void top() {
+    screenstate *previous_screen = (screenstate *)kmalloc(sizeof(screenstate));
+    if (previous_screen == NULL) {
+        kprintln("Not enough memory to save the screen");
+        return;
+    }
+
+    save_screen_to(previous_screen);
+    clear_screen();
+    memory_set((uint8_t *)screen, ' ', sizeof(screen));
+
+    running = true;
+    keyhandler previous_handler = swap_key_handler(&top_key_handler);
+
+    previous_stats = get_scheduler_stats();
+    for (int i = 0; i < 256; i++)
+        previous_counts[i] = interrupt_counts[i];
+
+    while (running) {
+        memory_set((uint8_t *)frame, ' ', sizeof(frame));
+        frame_row = frame_col = 0;
+
+        /* The sink is global, so nothing else may run and print into the frame while it's swapped in */
+        uint32_t flags = irq_save();
+        output_sink previous_sink = swap_output_sink(&frame_sink);
+        draw_frame(previous_handler);
+        return_output_sink(previous_sink);
+        irq_restore(flags);
+
+        present_frame();
+        set_cursor_offset(get_offset(0, MAX_ROWS - 1));
+
+        wait_event_timeout(&key_waiters, !running, REFRESH_TICKS);
+    }
+
+    return_key_handler(previous_handler);
+    load_screen_from(previous_screen);
+    kfree((size_t)previous_screen);
+}
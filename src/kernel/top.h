@@ -0,0 +1,6 @@
+#ifndef TOP_H_
+#define TOP_H_
+
+void top();
+
+#endif // TOP_H_
@@ -4,8 +4,11 @@
 #include "../drivers/keyboard.h"
 #include "../drivers/screen.h"
 #include "../libc/mem.h"
+#include "pacer.h"
 #include "shell.h"
+#include "waitqueue.h"
 
+/* Ticks per frame, every step waits a whole number of them */
 #define SPEED_FACTOR 75
 
 #define ARRAY_SIZE 20
@@ -70,6 +73,8 @@ void swap(int *array, int first, int second) {
 }
 
 static volatile bool running = true;
+static wait_queue quit_waiters = WAIT_QUEUE_INIT;
+static pacer frames;
 
 #define kprintf_at(col, row)                 \
     set_cursor_offset(get_offset(col, row)); \
@@ -100,7 +105,7 @@ void visualise_bubble(int *array) {
             kprintf_at(0, LINE2)("Swapping");
         }
 
-        wait(5 * SPEED_FACTOR);
+        pacer_wait(&frames, 5);
         render_array(array, ARRAY_STARTING_ROW);
 
         if (++current >= max) {
@@ -116,12 +121,12 @@ void visualise_bubble(int *array) {
                 kprintf_at(0, LINE3)("{i} is in its final place", current + 1);
                 current = 0;
                 max--;
-                wait(10 * SPEED_FACTOR);
+                pacer_wait(&frames, 10);
                 render_status(status);
             }
         }
 
-        wait(5 * SPEED_FACTOR);
+        pacer_wait(&frames, 5);
     }
 }
 
@@ -150,23 +155,23 @@ void visualise_insertion(int *array) {
 
             kprintf_at(0, LINE2)("Comparing positions {i} and {i}", j - 1, j);
 
-            wait(5 * SPEED_FACTOR);
+            pacer_wait(&frames, 5);
             if (array[j - 1] > array[j]) {
                 kprintf_at(0, LINE3)("Swapping");
                 swap(array, j, j - 1);
-                wait(5 * SPEED_FACTOR);
+                pacer_wait(&frames, 5);
                 render_array(array, ARRAY_STARTING_ROW);
             } else {
                 kprintf_at(0, LINE3)("Finished inserting element, continuing");
                 render_status(status);
-                wait(5 * SPEED_FACTOR);
+                pacer_wait(&frames, 5);
                 break;
             }
         }
 
         status[i] = NONE;
 
-        wait(5 * SPEED_FACTOR);
+        pacer_wait(&frames, 5);
     }
 
     mark_many(status, 0, ARRAY_SIZE, DONE);
@@ -188,7 +193,7 @@ int partition(int *array, int low, int high, enum Colors *status) {
     kprintf_at(0, LINE2)("Pivot is {i}", pivot);
     status[high] = SPECIAL;
     render_status(status);
-    wait(5 * SPEED_FACTOR);
+    pacer_wait(&frames, 5);
     clear_line(LINE2);
 
     int i = low - 1;
@@ -201,7 +206,7 @@ int partition(int *array, int low, int high, enum Colors *status) {
         RETURN_VALUE_IF(!running, 0);
         kprintf_at(0, LINE2)("Comparing {i} with pivot", j);
         status[j] = SELECTED;
-        wait(5 * SPEED_FACTOR);
+        pacer_wait(&frames, 5);
         RETURN_VALUE_IF(!running, 0);
         render_status(status);
         if (array[j] <= pivot) {
@@ -213,7 +218,7 @@ int partition(int *array, int low, int high, enum Colors *status) {
                 status[i] = INDEX;
             render_status(status);
             kprintf_at(0, LINE3)("Swapping");
-            wait(5 * SPEED_FACTOR);
+            pacer_wait(&frames, 5);
             RETURN_VALUE_IF(!running, 0);
             swap(array, i, j);
             render_array(array, ARRAY_STARTING_ROW);
@@ -228,7 +233,7 @@ int partition(int *array, int low, int high, enum Colors *status) {
     i++;
     kprintf_at(0, LINE2)("Moving pivot element into correct position ({i})", i);
     RETURN_VALUE_IF(!running, 0);
-    wait(5 * SPEED_FACTOR);
+    pacer_wait(&frames, 5);
     RETURN_VALUE_IF(!running, 0);
     swap(array, i, high);
     status[high] = NONE;
@@ -254,7 +259,7 @@ void quicksort(int *array, int low, int high, enum Colors *status) {
 
     clear_info();
     kprintf_at(0, LINE1)("Running quicksort from {i} to {i}", low, p - 1);
-    wait(5 * SPEED_FACTOR);
+    pacer_wait(&frames, 5);
     RETURN_IF(!running);
     quicksort(array, low, p - 1, status);
     RETURN_IF(!running);
@@ -262,7 +267,7 @@ void quicksort(int *array, int low, int high, enum Colors *status) {
 
     clear_info();
     kprintf_at(0, LINE1)("Running quicksort from {i} to {i}", p + 1, high);
-    wait(5 * SPEED_FACTOR);
+    pacer_wait(&frames, 5);
     RETURN_IF(!running);
     quicksort(array, p + 1, high, status);
     RETURN_IF(!running);
@@ -307,7 +312,7 @@ void merge(int *array, int low, int middle, int high) {
             low2++;
         }
         render_array(array, ARRAY_STARTING_ROW);
-        wait(3 * SPEED_FACTOR);
+        pacer_wait(&frames, 3);
     }
 }
 
@@ -321,7 +326,7 @@ void mergesort(enum Colors *status, int *array, int low, int high) {
     if (middle - low > 1) {
         clear_info();
         kprintf_at(0, LINE1)("Running mergesort from {i} to {i}", low, middle);
-        wait(5 * SPEED_FACTOR);
+        pacer_wait(&frames, 5);
     }
 
     RETURN_IF(!running);
@@ -331,7 +336,7 @@ void mergesort(enum Colors *status, int *array, int low, int high) {
     if (high - middle - 1 > 1) {
         clear_info();
         kprintf_at(0, LINE1)("Running mergesort from {i} to {i}", middle + 1, high);
-        wait(5 * SPEED_FACTOR);
+        pacer_wait(&frames, 5);
     }
 
     RETURN_IF(!running);
@@ -343,7 +348,7 @@ void mergesort(enum Colors *status, int *array, int low, int high) {
     mark_many(status, low, middle + 1, SELECTED);
     mark_many(status, middle + 1, high + 1, SPECIAL);
     render_status(status);
-    wait(5 * SPEED_FACTOR);
+    pacer_wait(&frames, 5);
     mark_many(status, low, high + 1, NONE);
     RETURN_IF(!running);
     merge(array, low, middle, high);
@@ -357,7 +362,7 @@ void visualise_merge(int *array) {
 
     clear_info();
     kprintf_at(0, LINE1)("Running mergesort");
-    wait(5 * SPEED_FACTOR);
+    pacer_wait(&frames, 5);
     RETURN_IF(!running);
     mergesort(status, array, 0, ARRAY_SIZE - 1);
     RETURN_IF(!running);
@@ -368,9 +373,10 @@ void visualise_merge(int *array) {
     render_array(array, ARRAY_STARTING_ROW);
 }
 
-void visualise_key_handler(uint8_t scancode) {
-    if (scancode == 16) {
+void visualise_key_handler(key_event event) {
+    if (KEY_PRESSED(event) && event.keycode == KEY_Q) {
         running = false;
+        wake_up_all(&quit_waiters);
     }
 }
 
@@ -402,10 +408,11 @@ void visualiser() {
         array[i] = t;
     }
 
+    pacer_start(&frames, "visualise", SPEED_FACTOR);
     render_array(array, ARRAY_STARTING_ROW);
     clear_info();
     kprintf_at(0, LINE1)("Starting array");
-    wait(20 * SPEED_FACTOR);
+    pacer_wait(&frames, 20);
 
     switch (algorithm) {
         case BUBBLE:
@@ -422,9 +429,7 @@ void visualiser() {
             break;
     }
 
-    while (running) {
-        asm volatile("nop");
-    }
+    wait_event(&quit_waiters, !running);
 
     running = true;
     load_screen_from(prev_screen);
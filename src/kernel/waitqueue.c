@@ -0,0 +1,156 @@
+#include "waitqueue.h"
+#include "../libc/atomic.h"
+#include "scheduler.h"
+
+#define COMPLETE_ALL 0xFFFFFFFF
+
+void wait_queue_init(wait_queue *wq) {
+    wq->head = wq->tail = NULL;
+}
+
+/**
+ * Queues the current thread on 'wq', leaving interrupts off so the condition can be checked once more
+ * without a wakeup slipping in between
+ * Returns the flags for finish_wait to put back
+ */
+uint32_t prepare_to_wait(wait_queue *wq, waiter *w) {
+    uint32_t flags = irq_save();
+
+    w->thread = thread_current();
+    w->woken = false;
+    w->next = NULL;
+    if (wq->tail == NULL)
+        wq->head = w;
+    else
+        wq->tail->next = w;
+    wq->tail = w;
+
+    return flags;
+}
+
+/**
+ * Parks until woken, or until 'timeout' ticks have passed if it isn't 0
+ * Called with interrupts off, and returns with them off
+ */
+void wait_park(waiter *w, uint32_t timeout) {
+    if (!thread_is_boot()) {
+        if (timeout != 0)
+            thread_sleep(timeout);
+        else
+            thread_block();
+        return;
+    }
+
+    /* Whatever wakes the boot thread is probably a bottom half, which only it can run */
+    bool was_idle = set_idle(true);
+    irq_enable();
+    run_bottom_halves();
+    if (!w->woken && !thread_yield())
+        idle_until_interrupt();
+    irq_disable();
+    set_idle(was_idle);
+}
+
+/**
+ * Takes the waiter back off the queue if nothing woke it, and puts the interrupt flag back
+ */
+void finish_wait(wait_queue *wq, waiter *w, uint32_t flags) {
+    if (!w->woken) {
+        waiter *previous = NULL;
+        for (waiter *current = wq->head; current != NULL; previous = current, current = current->next) {
+            if (current != w)
+                continue;
+
+            if (previous == NULL)
+                wq->head = w->next;
+            else
+                previous->next = w->next;
+            if (wq->tail == w)
+                wq->tail = previous;
+            break;
+        }
+    }
+
+    irq_restore(flags);
+}
+
+/* Interrupts have to be off */
+static bool wake_one(wait_queue *wq) {
+    waiter *w = wq->head;
+    if (w == NULL)
+        return false;
+
+    wq->head = w->next;
+    if (wq->head == NULL)
+        wq->tail = NULL;
+
+    w->woken = true;
+    thread_wake(w->thread); /* Nothing for the boot thread, it notices w->woken */
+    return true;
+}
+
+/**
+ * Wakes the longest waiting waiter, if there is one
+ */
+void wake_up(wait_queue *wq) {
+    uint32_t flags = irq_save();
+    wake_one(wq);
+    irq_restore(flags);
+}
+
+void wake_up_all(wait_queue *wq) {
+    uint32_t flags = irq_save();
+    while (wake_one(wq))
+        ;
+    irq_restore(flags);
+}
+
+void init_completion(completion *c) {
+    c->done = 0;
+    wait_queue_init(&c->waiters);
+}
+
+void complete(completion *c) {
+    uint32_t flags = irq_save();
+    if (c->done != COMPLETE_ALL)
+        c->done++;
+    wake_up(&c->waiters);
+    irq_restore(flags);
+}
+
+void complete_all(completion *c) {
+    uint32_t flags = irq_save();
+    c->done = COMPLETE_ALL;
+    wake_up_all(&c->waiters);
+    irq_restore(flags);
+}
+
+/**
+ * Takes one completion if there is one, with interrupts off so two waiters can't both take the last
+ */
+static bool try_take(completion *c) {
+    uint32_t flags = irq_save();
+    bool taken = c->done != 0;
+    if (taken && c->done != COMPLETE_ALL)
+        c->done--;
+    irq_restore(flags);
+    return taken;
+}
+
+void wait_for_completion(completion *c) {
+    while (!try_take(c))
+        wait_event(&c->waiters, c->done != 0);
+}
+
+/**
+ * Returns false if nothing completed within 'ticks' ticks
+ */
+bool wait_for_completion_timeout(completion *c, uint32_t ticks) {
+    uint32_t deadline = get_tick() + ticks;
+    while (!try_take(c)) {
+        int32_t remaining = deadline - get_tick();
+        if (remaining <= 0 || !wait_event_timeout(&c->waiters, c->done != 0, remaining))
+            return false;
+    }
+    return true;
+}
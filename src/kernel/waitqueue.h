@@ -0,0 +1,75 @@
+#ifndef WAITQUEUE_H_
+#define WAITQUEUE_H_
+
+#include "../cpu/timer.h"
+#include "../cpu/types.h"
+#include "thread.h"
+
+/* Wait queues and completions
+ *
+ * A waiter queues itself, checks its condition once more with interrupts off, and parks: a thread blocks
+ * until it's woken, and the boot thread (which can't block) keeps interrupt work and other threads going
+ * and halts in between. Waking only takes interrupts off, so interrupt handlers and bottom halves can
+ * signal them. Wakeups can be spurious, so the wait_event macros recheck the condition each time round. */
+
+typedef struct Waiter {
+    thread *thread;
+    volatile bool woken;
+    struct Waiter *next;
+} waiter;
+
+typedef struct WaitQueue {
+    waiter *head;
+    waiter *tail;
+} wait_queue;
+
+#define WAIT_QUEUE_INIT {NULL, NULL}
+
+void wait_queue_init(wait_queue *wq);
+uint32_t prepare_to_wait(wait_queue *wq, waiter *w);
+void wait_park(waiter *w, uint32_t timeout);
+void finish_wait(wait_queue *wq, waiter *w, uint32_t flags);
+void wake_up(wait_queue *wq);
+void wake_up_all(wait_queue *wq);
+
+/* Waits until 'condition' is true, which whoever makes it true should follow with a wake_up */
+#define wait_event(wq, condition)                                    \
+    do {                                                             \
+        while (!(condition)) {                                       \
+            waiter __waiter;                                         \
+            uint32_t __flags = prepare_to_wait((wq), &__waiter);     \
+            if (!(condition))                                        \
+                wait_park(&__waiter, 0);                             \
+            finish_wait((wq), &__waiter, __flags);                   \
+        }                                                            \
+    } while (0)
+
+/* As wait_event, but gives up after 'ticks' ticks, and is whether the condition came true */
+#define wait_event_timeout(wq, condition, ticks)                                      \
+    ({                                                                                \
+        uint32_t __deadline = get_tick() + (ticks);                                   \
+        while (!(condition) && (int32_t)(__deadline - get_tick()) > 0) {              \
+            waiter __waiter;                                                          \
+            uint32_t __flags = prepare_to_wait((wq), &__waiter);                      \
+            if (!(condition) && (int32_t)(__deadline - get_tick()) > 0)               \
+                wait_park(&__waiter, __deadline - get_tick());                        \
+            finish_wait((wq), &__waiter, __flags);                                    \
+        }                                                                             \
+        (bool)(condition);                                                            \
+    })
+
+/* A one-shot event: complete() lets one waiter through, complete_all() every one from then on */
+typedef struct Completion {
+    volatile uint32_t done;
+    wait_queue waiters;
+} completion;
+
+#define COMPLETION_INIT {0, WAIT_QUEUE_INIT}
+
+void init_completion(completion *c);
+void complete(completion *c);
+void complete_all(completion *c);
+void wait_for_completion(completion *c);
+bool wait_for_completion_timeout(completion *c, uint32_t ticks);
+
+#endif // WAITQUEUE_H_
@@ -0,0 +1,233 @@
+#include "workqueue.h"
+#include "../cpu/clock.h"
+#include "../cpu/smp.h"
+#include "../drivers/debugcon.h"
+#include "../drivers/screen.h"
+#include "../libc/atomic.h"
+#include "../libc/lock.h"
+
+#define IDLE_SPINS 1000 // Tries for more work before an AP halts, there's often more only moments away
+
+typedef struct WorkItem {
+    action1 function;
+    void *data;
+} work_item;
+
+typedef struct WorkQueue {
+    ticket_lock lock;
+    uint32_t head; /* Next free slot, the owner takes from just below it */
+    uint32_t tail; /* Oldest item, where thieves take from */
+    work_item items[WORK_QUEUE_SIZE];
+    volatile uint32_t run, stolen; /* Items this CPU has run, and how many of them it stole */
+} work_queue;
+
+static work_queue queues[MAX_CPUS];
+static volatile int active_cpus = MAX_CPUS;
+
+static const char *lock_names[MAX_CPUS] = {
+    "work queue 0", "work queue 1", "work queue 2", "work queue 3",
+    "work queue 4", "work queue 5", "work queue 6", "work queue 7",
+};
+
+void init_work_queues() {
+    for (int i = 0; i < MAX_CPUS; i++)
+        ticket_init(&queues[i].lock, lock_names[i]);
+}
+
+/**
+ * Queues work on the current CPU, for it or whoever steals it to run
+ * Safe from interrupt handlers, the queue lock is held with interrupts off
+ * Returns false if the queue is full, the caller can run it itself
+ */
+bool submit_work(action1 function, void *data) {
+    work_queue *queue = &queues[this_cpu()->index];
+
+    uint32_t flags = ticket_acquire_irqsave(&queue->lock);
+    bool queued = queue->head - queue->tail != WORK_QUEUE_SIZE;
+    if (queued)
+        queue->items[queue->head++ % WORK_QUEUE_SIZE] = (work_item){function, data};
+    ticket_release_irqrestore(&queue->lock, flags);
+
+    /* One sleeping CPU is enough, whoever gets there first takes it */
+    for (int i = 0; queued && i < active_cpus && i < cpu_count(); i++) {
+        if (wake_cpu(i))
+            break;
+    }
+
+    return queued;
+}
+
+static bool take_newest(work_queue *queue, work_item *item) {
+    uint32_t flags = ticket_acquire_irqsave(&queue->lock);
+    bool taken = queue->head != queue->tail;
+    if (taken)
+        *item = queue->items[--queue->head % WORK_QUEUE_SIZE];
+    ticket_release_irqrestore(&queue->lock, flags);
+    return taken;
+}
+
+static bool take_oldest(work_queue *queue, work_item *item) {
+    uint32_t flags = ticket_acquire_irqsave(&queue->lock);
+    bool taken = queue->head != queue->tail;
+    if (taken)
+        *item = queue->items[queue->tail++ % WORK_QUEUE_SIZE];
+    ticket_release_irqrestore(&queue->lock, flags);
+    return taken;
+}
+
+/**
+ * Picks the active CPU with the most queued, read without locking, so it's only a hint
+ * Returns -1 if every other queue looks empty
+ */
+static int fullest_queue(int thief) {
+    int victim = -1;
+    uint32_t most = 0;
+    for (int i = 0; i < active_cpus; i++) {
+        uint32_t queued = queues[i].head - queues[i].tail;
+        if (i != thief && queued > most) {
+            victim = i;
+            most = queued;
+        }
+    }
+    return victim;
+}
+
+/**
+ * Runs one work item, the current CPU's own newest or one stolen from the fullest queue
+ * Returns false if there wasn't any work anywhere
+ */
+bool run_work() {
+    int index = this_cpu()->index;
+    if (index >= active_cpus)
+        return false;
+
+    work_item item;
+    bool stolen = false;
+    if (!take_newest(&queues[index], &item)) {
+        int victim = fullest_queue(index);
+        if (victim < 0 || !take_oldest(&queues[victim], &item))
+            return false;
+        stolen = true;
+    }
+
+    (*item.function)(item.data);
+    queues[index].run++;
+    if (stolen)
+        queues[index].stolen++;
+    return true;
+}
+
+/**
+ * Whether there's queued work this CPU could take, read without locking
+ */
+static bool work_waiting() {
+    int index = this_cpu()->index;
+    if (index >= active_cpus)
+        return false;
+
+    for (int i = 0; i < active_cpus; i++) {
+        if (queues[i].head != queues[i].tail)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * What the APs run once they're up: work when there is some, a short spin on pause when there isn't, then
+ * a halt until submit_work wakes them, so idle APs don't keep host CPUs busy
+ */
+void work_loop() {
+    int idle = 0;
+    while (true) {
+        if (run_work()) {
+            idle = 0;
+        } else if (++idle < IDLE_SPINS) {
+            cpu_relax();
+        } else {
+            cpu_sleep(&work_waiting);
+            idle = 0;
+        }
+    }
+}
+
+/**
+ * Limits work to the first 'count' CPUs, the rest sit it out
+ */
+void set_active_cpus(int count) {
+    active_cpus = count;
+}
+
+void print_work_stats() {
+    for (int i = 0; i < cpu_count(); i++)
+        kprintlnf("CPU {i}: {u} work items run, {u} of them stolen", i, queues[i].run, queues[i].stolen);
+}
+
+/* Counting primes in SCALING_ITEMS ranges, as the parallel CPU-bound workload */
+#define SCALING_ITEMS 64
+#define SCALING_RANGE 2048
+
+static uint32_t prime_counts[SCALING_ITEMS];
+static atomic_uint remaining;
+
+static void count_primes(void *data) {
+    uint32_t item = (uint32_t)data;
+    uint32_t count = 0;
+    for (uint32_t n = item * SCALING_RANGE; n < (item + 1) * SCALING_RANGE; n++) {
+        bool prime = n >= 2;
+        for (uint32_t d = 2; prime && d * d <= n; d++)
+            prime = n % d != 0;
+        count += prime;
+    }
+    prime_counts[item] = count;
+    atomic_fetch_add(&remaining, -1);
+}
+
+/**
+ * Runs the whole workload on 1 CPU, then 2, up to every online one, and prints the speedup over 1
+ * The bootstrap processor queues it all and works alongside, everyone else gets theirs by stealing
+ */
+void run_scaling_benchmark() {
+    int online = online_cpus();
+    uint64_t single = 0;
+
+    kprintlnf("{i} items of {i} numbers, counting primes", SCALING_ITEMS, SCALING_RANGE);
+    kprintln("CPUs       cycles  speedup  primes");
+
+    for (int cpus_used = 1; cpus_used <= online; cpus_used++) {
+        set_active_cpus(cpus_used);
+        atomic_store(&remaining, SCALING_ITEMS);
+
+        uint64_t start = clock_cycles();
+        for (uint32_t i = 0; i < SCALING_ITEMS; i++) {
+            if (!submit_work(&count_primes, (void *)i))
+                count_primes((void *)i);
+        }
+        while (atomic_load(&remaining) > 0) {
+            if (!run_work())
+                cpu_relax();
+        }
+        uint64_t cycles = clock_cycles() - start;
+
+        uint32_t primes = 0;
+        for (int i = 0; i < SCALING_ITEMS; i++)
+            primes += prime_counts[i];
+
+        if (cpus_used == 1)
+            single = cycles;
+        uint32_t speedup = (uint32_t)(single * 100 / cycles);
+        kprintlnf("{i}  {u}  {u}.{u}{u}x  {u}", cpus_used, (uint32_t)cycles, speedup / 100, speedup / 10 % 10,
+            speedup % 10, primes);
+
+        debug_print("{\"bench\":\"smp_scaling\",\"cpus\":");
+        debug_print_uint(cpus_used);
+        debug_print(",\"cycles\":");
+        debug_print_uint((uint32_t)cycles);
+        debug_print(",\"ns\":");
+        debug_print_uint((uint32_t)cycles_to_ns(cycles));
+        debug_print(",\"speedup_percent\":");
+        debug_print_uint(speedup);
+        debug_print(",\"unit\":\"cycles\"}\n");
+    }
+
+    set_active_cpus(MAX_CPUS);
+}
@@ -0,0 +1,28 @@
+#ifndef WORKQUEUE_H_
+#define WORKQUEUE_H_
+
+#include "../cpu/types.h"
+#include "../libc/function.h"
+
+/* Per-CPU work queues
+ *
+ * Work is queued on the submitting CPU, from a thread or an interrupt handler. Each CPU runs its own newest
+ * item first, and an idle CPU steals the oldest item of the fullest queue going. The queue locks are held with
+ * interrupts off, so a handler submitting can't deadlock against its own CPU taking an item.
+ *
+ * Work items run on any CPU: with interrupts off on the APs, but with them on on the bootstrap processor, which
+ * runs them from the scheduler loop. So they can't print, allocate or touch anything else that's only safe on
+ * one CPU, or anything an interrupt handler changes without a lock; the scheduler's run queue still belongs to
+ * the bootstrap processor. */
+#define WORK_QUEUE_SIZE 64 // Must be a power of two
+
+void init_work_queues();
+bool submit_work(action1 function, void *data);
+bool run_work();
+void work_loop();
+
+void set_active_cpus(int count);
+void print_work_stats();
+void run_scaling_benchmark();
+
+#endif // WORKQUEUE_H_
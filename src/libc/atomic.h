@@ -0,0 +1,123 @@
+#ifndef ATOMIC_H_
+#define ATOMIC_H_
+
+#include "../cpu/types.h"
+#include "irqsoff.h"
+
+/* Typed atomics over the x86 locked instructions
+ *
+ * Every read-modify-write here is a full barrier, and aligned 32 bit loads and stores are atomic on their own,
+ * so atomic_load and atomic_store only have to stop the compiler moving things across them. */
+typedef struct {
+    volatile uint32_t value;
+} atomic_uint;
+
+typedef struct {
+    void *volatile value;
+} atomic_ptr;
+
+#define ATOMIC_INIT(initial) {(initial)}
+
+static inline uint32_t atomic_load(const atomic_uint *atomic) {
+    uint32_t value = atomic->value;
+    asm volatile("" : : : "memory");
+    return value;
+}
+
+static inline void atomic_store(atomic_uint *atomic, uint32_t value) {
+    asm volatile("" : : : "memory");
+    atomic->value = value;
+}
+
+/* Adds and returns the value from before */
+static inline uint32_t atomic_fetch_add(atomic_uint *atomic, uint32_t value) {
+    asm volatile("lock xaddl %0, %1" : "+r"(value), "+m"(atomic->value) : : "memory");
+    return value;
+}
+
+static inline uint32_t atomic_exchange(atomic_uint *atomic, uint32_t value) {
+    asm volatile("xchgl %0, %1" : "+r"(value), "+m"(atomic->value) : : "memory");
+    return value;
+}
+
+/**
+ * Swaps in 'desired' if the value is still 'expected'
+ * Returns whether it did, and leaves what the value actually was in 'expected'
+ */
+static inline bool atomic_compare_exchange(atomic_uint *atomic, uint32_t *expected, uint32_t desired) {
+    uint32_t previous = *expected;
+    asm volatile("lock cmpxchgl %2, %1" : "+a"(previous), "+m"(atomic->value) : "r"(desired) : "memory");
+    bool swapped = previous == *expected;
+    *expected = previous;
+    return swapped;
+}
+
+static inline void atomic_or(atomic_uint *atomic, uint32_t bits) {
+    asm volatile("lock orl %1, %0" : "+m"(atomic->value) : "r"(bits) : "memory");
+}
+
+static inline void atomic_and(atomic_uint *atomic, uint32_t bits) {
+    asm volatile("lock andl %1, %0" : "+m"(atomic->value) : "r"(bits) : "memory");
+}
+
+static inline void *atomic_load_ptr(const atomic_ptr *atomic) {
+    void *value = atomic->value;
+    asm volatile("" : : : "memory");
+    return value;
+}
+
+static inline void atomic_store_ptr(atomic_ptr *atomic, void *value) {
+    asm volatile("" : : : "memory");
+    atomic->value = value;
+}
+
+static inline void *atomic_exchange_ptr(atomic_ptr *atomic, void *value) {
+    asm volatile("xchgl %0, %1" : "+r"(value), "+m"(atomic->value) : : "memory");
+    return value;
+}
+
+static inline bool atomic_compare_exchange_ptr(atomic_ptr *atomic, void **expected, void *desired) {
+    void *previous = *expected;
+    asm volatile("lock cmpxchgl %2, %1" : "+a"(previous), "+m"(atomic->value) : "r"(desired) : "memory");
+    bool swapped = previous == *expected;
+    *expected = previous;
+    return swapped;
+}
+
+#define EFLAGS_IF 0x200
+
+/**
+ * Interrupts off on this CPU, returning the flags to put back, for data shared with interrupt handlers
+ * If they were on, that opens an interrupts-off window blamed on 'site' (see irqsoff.h)
+ */
+static inline __attribute__((always_inline)) uint32_t irq_save_at(uint32_t site) {
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    if (flags & EFLAGS_IF)
+        IRQSOFF_BEGIN(site);
+    return flags;
+}
+
+/* Blamed on wherever it's called from */
+#define irq_save() irq_save_at(CURRENT_ADDRESS())
+
+static inline void irq_restore(uint32_t flags) {
+    if (flags & EFLAGS_IF)
+        IRQSOFF_END();
+    asm volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
+
+/* For the odd section that isn't a save and restore pair, e.g. across a thread's first switch */
+#define irq_disable() ((void)irq_save())
+
+static inline void irq_enable() {
+    IRQSOFF_END();
+    asm volatile("sti" : : : "memory");
+}
+
+/* In spin loops, so a hyperthread sibling (or the host, under a hypervisor) gets the pipeline */
+static inline void cpu_relax() {
+    asm volatile("pause");
+}
+
+#endif // ATOMIC_H_
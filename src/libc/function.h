@@ -7,6 +7,9 @@
  * and this is a solution to avoid the 'unused parameter' compiler warning */
 #define UNUSED(x) (void)(x)
 
+/* Keeps a function out of -finstrument-functions builds, for what its hooks call (see kernel/instrument.h) */
+#define NO_INSTRUMENT __attribute__((no_instrument_function))
+
 // Predicates: Functions that take an input and produce a boolean
 typedef bool *predicate(void *input);
 
@@ -0,0 +1,80 @@
+#include "histogram.h"
+#include "../drivers/screen.h"
+#include "mem.h"
+
+void histogram_reset(histogram *h) {
+    memory_set((uint8_t *)h, 0, sizeof(histogram));
+}
+
+static int bucket_of(uint32_t value) {
+    return value == 0 ? 0 : 32 - __builtin_clz(value);
+}
+
+/* Largest value that lands in the given bucket */
+static uint32_t bucket_limit(int bucket) {
+    return bucket == 32 ? 0xFFFFFFFF : (1u << bucket) - 1;
+}
+
+void histogram_add(histogram *h, uint32_t value) {
+    h->buckets[bucket_of(value)]++;
+
+    if (h->count == 0 || value < h->min)
+        h->min = value;
+    if (value > h->max)
+        h->max = value;
+
+    h->count++;
+    h->total += value;
+}
+
+/**
+ * Returns an upper bound for the given percentile: the top of the bucket it falls in, or the maximum if that is lower
+ */
+uint32_t histogram_percentile(const histogram *h, uint32_t percent) {
+    if (h->count == 0)
+        return 0;
+
+    /* Rank of the sample we're after, rounded up so p100 is the last sample */
+    uint32_t rank = ((uint64_t)h->count * percent + 99) / 100;
+    if (rank == 0)
+        rank = 1;
+
+    uint32_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank)
+            return bucket_limit(i) < h->max ? bucket_limit(i) : h->max;
+    }
+
+    return h->max;
+}
+
+uint32_t histogram_mean(const histogram *h) {
+    return h->count ? h->total / h->count : 0;
+}
+
+#define BAR_WIDTH 40
+
+/**
+ * Prints every non-empty bucket with a bar scaled to the fullest one
+ */
+void print_histogram(const histogram *h) {
+    uint32_t fullest = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (h->buckets[i] > fullest)
+            fullest = h->buckets[i];
+    }
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (h->buckets[i] == 0)
+            continue;
+
+        char bar[BAR_WIDTH + 1];
+        int length = (uint64_t)h->buckets[i] * BAR_WIDTH / fullest;
+        for (int j = 0; j < length; j++)
+            bar[j] = '#';
+        bar[length] = '\0';
+
+        kprintlnf("<= {u}: {u} {}", bucket_limit(i), h->buckets[i], bar);
+    }
+}
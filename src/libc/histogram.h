@@ -0,0 +1,24 @@
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+#include "../cpu/types.h"
+
+/* Log2-bucketed histogram, bucket i counts the values whose highest set bit is i - 1 (bucket 0 counts zeros)
+ * Constant size and constant time to add to, at the cost of percentiles only being accurate to a power of two */
+#define HISTOGRAM_BUCKETS 33
+
+typedef struct Histogram {
+    uint32_t buckets[HISTOGRAM_BUCKETS];
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+} histogram;
+
+void histogram_reset(histogram *h);
+void histogram_add(histogram *h, uint32_t value);
+uint32_t histogram_percentile(const histogram *h, uint32_t percent);
+uint32_t histogram_mean(const histogram *h);
+void print_histogram(const histogram *h);
+
+#endif // HISTOGRAM_H_
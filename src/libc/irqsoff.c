@@ -0,0 +1,142 @@
+#include "irqsoff.h"
+#include "../cpu/clock.h"
+#include "../cpu/info.h"
+#include "../cpu/smp.h"
+#include "../cpu/timer.h"
+#include "../drivers/screen.h"
+#include "../kernel/symbols.h"
+#include "atomic.h"
+
+volatile bool irqsoff_tracing = false;
+
+/* Everything below is only touched with interrupts off on the bootstrap processor */
+static bool open = false;
+static uint64_t opened_at;
+static uint32_t opened_site;
+
+static irqsoff_site sites[IRQSOFF_SITES];
+static uint32_t site_count, unplaced; /* Windows from sites past the first IRQSOFF_SITES */
+static histogram windows; /* Nanoseconds */
+
+static uint64_t tick_period; /* Cycles */
+static uint64_t last_tick;
+static histogram jitter; /* Nanoseconds from one period after the last tick */
+static uint32_t late_ticks, max_late;
+
+/**
+ * Opens a window, or restarts one a missed end left open (e.g. an IRQ, which can only come with interrupts on)
+ */
+void irqsoff_begin(uint32_t site) {
+    if (this_cpu()->index != 0)
+        return;
+
+    open = true;
+    opened_at = rdtsc();
+    opened_site = site;
+}
+
+static irqsoff_site *find_site(uint32_t site) {
+    for (uint32_t i = 0; i < site_count; i++) {
+        if (sites[i].site == site)
+            return &sites[i];
+    }
+    if (site_count == IRQSOFF_SITES)
+        return NULL;
+
+    irqsoff_site *added = &sites[site_count++];
+    added->site = site;
+    added->count = added->max = 0;
+    added->total = 0;
+    return added;
+}
+
+void irqsoff_end() {
+    if (!open || this_cpu()->index != 0)
+        return;
+    open = false;
+
+    uint32_t cycles = (uint32_t)(rdtsc() - opened_at);
+    histogram_add(&windows, (uint32_t)cycles_to_ns(cycles));
+
+    irqsoff_site *site = find_site(opened_site);
+    if (site == NULL) {
+        unplaced++;
+        return;
+    }
+    site->count++;
+    site->total += cycles;
+    if (cycles > site->max)
+        site->max = cycles;
+}
+
+/**
+ * Called from the PIT's IRQ, times the gap from the last one against the PIT's period
+ */
+void irqsoff_tick() {
+    uint64_t now = rdtsc();
+    if (last_tick != 0) {
+        int64_t off = (int64_t)(now - last_tick) - (int64_t)tick_period;
+        uint32_t ns = (uint32_t)cycles_to_ns(off < 0 ? -off : off);
+        histogram_add(&jitter, ns);
+        if (off > 0) {
+            late_ticks++;
+            if (ns > max_late)
+                max_late = ns;
+        }
+    }
+    last_tick = now;
+}
+
+void irqsoff_start() {
+    uint32_t flags = irq_save();
+    irqsoff_tracing = false;
+    open = false;
+    site_count = unplaced = 0;
+    histogram_reset(&windows);
+    histogram_reset(&jitter);
+    late_ticks = max_late = 0;
+    last_tick = 0;
+    tick_period = tick_cycles();
+    irqsoff_tracing = true;
+    irq_restore(flags);
+}
+
+void irqsoff_stop() {
+    irqsoff_tracing = false;
+}
+
+/**
+ * Prints the sites with the longest windows, the window histogram and the PIT jitter histogram
+ */
+void print_irqsoff() {
+    kprintlnf("Interrupts-off windows: {u} ({}), {u} ns p50, {u} ns p99, {u} ns max", windows.count,
+        irqsoff_tracing ? "tracing" : "stopped", histogram_percentile(&windows, 50),
+        histogram_percentile(&windows, 99), windows.max);
+
+    /* Worst first, picking out the longest left each time and marking it taken with the top bit */
+    kprintln("Longest from    count  mean / max ns");
+    for (int shown = 0; shown < 8; shown++) {
+        irqsoff_site *worst = NULL;
+        for (uint32_t i = 0; i < site_count; i++) {
+            if (!(sites[i].max & 0x80000000) && (worst == NULL || sites[i].max > worst->max))
+                worst = &sites[i];
+        }
+        if (worst == NULL)
+            break;
+
+        kprintlnf("{} ({x})  {u}  {u} / {u}", symbol_name(worst->site), worst->site, worst->count,
+            (uint32_t)cycles_to_ns(worst->total / worst->count), (uint32_t)cycles_to_ns(worst->max));
+        worst->max |= 0x80000000;
+    }
+    for (uint32_t i = 0; i < site_count; i++)
+        sites[i].max &= ~0x80000000;
+    if (unplaced != 0)
+        kprintlnf("{u} more from sites past the first {u}", unplaced, IRQSOFF_SITES);
+
+    print_histogram(&windows);
+
+    kprintlnf("PIT tick jitter over {u} ticks (periodic mode only): {u} ns p50, {u} ns p99", jitter.count,
+        histogram_percentile(&jitter, 50), histogram_percentile(&jitter, 99));
+    kprintlnf("{u} ticks late, by up to {u} ns", late_ticks, max_late);
+    print_histogram(&jitter);
+}
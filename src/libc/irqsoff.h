@@ -0,0 +1,55 @@
+#ifndef IRQSOFF_H_
+#define IRQSOFF_H_
+
+#include "../cpu/types.h"
+#include "histogram.h"
+
+/* Interrupts-off latency tracer
+ *
+ * A window opens where the bootstrap processor turns interrupts off (irq_save and the rest in atomic.h, or
+ * the CPU taking an IRQ) and closes where they go back on, and while tracing each one is timed with the TSC
+ * and charged to the code address it opened at. Every window delays any interrupt that comes in during it,
+ * so the longest ones are the worst case for the timer and the keyboard. The timer IRQ also measures how far
+ * each PIT tick lands from one period after the last, the jitter those windows (and everything else) cause.
+ *
+ * The hooks cost one predictable branch while it's off, like the tracepoints. */
+#define IRQSOFF_SITES 32
+
+/* The address of the code it's in, with no call to get it */
+#define CURRENT_ADDRESS()                                  \
+    ({                                                     \
+        uint32_t __address;                                \
+        asm volatile("movl $1f, %0\n1:" : "=r"(__address)); \
+        __address;                                         \
+    })
+
+extern volatile bool irqsoff_tracing;
+
+void irqsoff_begin(uint32_t site);
+void irqsoff_end();
+void irqsoff_tick();
+
+#define IRQSOFF_BEGIN(site)                              \
+    do {                                                 \
+        if (__builtin_expect(irqsoff_tracing, 0))        \
+            irqsoff_begin(site);                         \
+    } while (0)
+
+#define IRQSOFF_END()                                    \
+    do {                                                 \
+        if (__builtin_expect(irqsoff_tracing, 0))        \
+            irqsoff_end();                               \
+    } while (0)
+
+typedef struct IrqsoffSite {
+    uint32_t site; /* Where the window opened */
+    uint32_t count;
+    uint32_t max; /* Cycles */
+    uint64_t total;
+} irqsoff_site;
+
+void irqsoff_start();
+void irqsoff_stop();
+void print_irqsoff();
+
+#endif // IRQSOFF_H_
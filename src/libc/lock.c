@@ -0,0 +1,141 @@
+#include "lock.h"
+#include "../cpu/info.h"
+#include "../drivers/screen.h"
+
+static atomic_ptr all_stats = ATOMIC_INIT(NULL);
+
+/**
+ * Counts an acquisition that took 'spins' times round the wait loop, called with the lock held
+ */
+static void acquired(lock_stats *stats, uint32_t spins) {
+    if (stats->name == NULL)
+        return;
+
+    if (!stats->registered) {
+        stats->registered = true;
+        void *head = atomic_load_ptr(&all_stats);
+        do
+            stats->next = head;
+        while (!atomic_compare_exchange_ptr(&all_stats, &head, stats));
+    }
+
+    stats->acquisitions++;
+    if (spins > 0) {
+        stats->contended++;
+        stats->spins += spins;
+    }
+    stats->acquired_at = (uint32_t)rdtsc();
+}
+
+/* Called just before the lock is let go */
+static void releasing(lock_stats *stats) {
+    if (stats->name == NULL)
+        return;
+
+    uint32_t held = (uint32_t)rdtsc() - stats->acquired_at;
+    if (held > stats->max_hold)
+        stats->max_hold = held;
+}
+
+static void init_stats(lock_stats *stats, const char *name) {
+    stats->name = name;
+    stats->registered = false;
+    stats->acquisitions = stats->contended = stats->spins = stats->max_hold = 0;
+}
+
+void ticket_init(ticket_lock *lock, const char *name) {
+    atomic_store(&lock->next_ticket, 0);
+    atomic_store(&lock->serving, 0);
+    init_stats(&lock->stats, name);
+}
+
+void ticket_acquire(ticket_lock *lock) {
+    uint32_t ticket = atomic_fetch_add(&lock->next_ticket, 1);
+    uint32_t spins = 0;
+    while (atomic_load(&lock->serving) != ticket) {
+        cpu_relax();
+        spins++;
+    }
+    acquired(&lock->stats, spins);
+}
+
+void ticket_release(ticket_lock *lock) {
+    releasing(&lock->stats);
+    /* Only the holder writes 'serving', so this doesn't need to be locked */
+    atomic_store(&lock->serving, atomic_load(&lock->serving) + 1);
+}
+
+uint32_t ticket_acquire_irqsave(ticket_lock *lock) {
+    uint32_t flags = irq_save_at((uint32_t)__builtin_return_address(0));
+    ticket_acquire(lock);
+    return flags;
+}
+
+void ticket_release_irqrestore(ticket_lock *lock, uint32_t flags) {
+    ticket_release(lock);
+    irq_restore(flags);
+}
+
+void mcs_init(mcs_lock *lock, const char *name) {
+    atomic_store_ptr(&lock->tail, NULL);
+    init_stats(&lock->stats, name);
+}
+
+/**
+ * Takes the lock, queueing 'node' (which has to stay put until the release, e.g. on the stack) behind any waiters
+ */
+void mcs_acquire(mcs_lock *lock, mcs_node *node) {
+    node->next = NULL;
+    node->waiting = true;
+
+    uint32_t spins = 0;
+    mcs_node *previous = atomic_exchange_ptr(&lock->tail, node);
+    if (previous != NULL) {
+        previous->next = node;
+        while (node->waiting) {
+            cpu_relax();
+            spins++;
+        }
+    }
+    acquired(&lock->stats, spins);
+}
+
+void mcs_release(mcs_lock *lock, mcs_node *node) {
+    releasing(&lock->stats);
+
+    if (node->next == NULL) {
+        /* Nobody queued behind, unless someone's between swapping the tail and linking themselves in */
+        void *expected = node;
+        if (atomic_compare_exchange_ptr(&lock->tail, &expected, NULL))
+            return;
+        while (node->next == NULL)
+            cpu_relax();
+    }
+    node->next->waiting = false;
+}
+
+uint32_t mcs_acquire_irqsave(mcs_lock *lock, mcs_node *node) {
+    uint32_t flags = irq_save_at((uint32_t)__builtin_return_address(0));
+    mcs_acquire(lock, node);
+    return flags;
+}
+
+void mcs_release_irqrestore(mcs_lock *lock, mcs_node *node, uint32_t flags) {
+    mcs_release(lock, node);
+    irq_restore(flags);
+}
+
+void print_lock_stats() {
+    kprintln("Lock           acquired  contended  spins  max hold (cycles)");
+    for (lock_stats *stats = atomic_load_ptr(&all_stats); stats != NULL; stats = stats->next)
+        kprintlnf("{}  {u}  {u}  {u}  {u}", stats->name, stats->acquisitions, stats->contended, stats->spins,
+            stats->max_hold);
+}
+
+/**
+ * Zeroes every lock's statistics, racing anyone holding one, so only good for a fresh start
+ */
+void reset_lock_stats() {
+    for (lock_stats *stats = atomic_load_ptr(&all_stats); stats != NULL; stats = stats->next)
+        stats->acquisitions = stats->contended = stats->spins = stats->max_hold = 0;
+}
@@ -0,0 +1,62 @@
+#ifndef LOCK_H_
+#define LOCK_H_
+
+#include "../cpu/types.h"
+#include "atomic.h"
+
+/* Spinlocks
+ *
+ * Ticket locks hand out a number and serve them in order, everyone spinning on the one cache line.
+ * MCS locks queue the waiters up, each spinning on its own node, which is better once there are many.
+ * The _irqsave variants hold interrupts off as well, for anything an interrupt handler takes too;
+ * a plain acquire of a lock a handler also takes can deadlock against that handler on the same CPU.
+ *
+ * A lock made with a name keeps statistics, which are updated while it's held so need no atomics,
+ * and it's added to the list 'locks' prints the first time it's taken. */
+
+typedef struct LockStats {
+    const char *name; /* NULL for a lock that doesn't keep statistics */
+    bool registered;
+    uint32_t acquisitions;
+    uint32_t contended; /* Acquisitions that had to wait */
+    uint32_t spins;     /* Times round a wait loop, over all of them */
+    uint32_t max_hold;  /* Cycles */
+    uint32_t acquired_at;
+    struct LockStats *next;
+} lock_stats;
+
+typedef struct TicketLock {
+    atomic_uint next_ticket;
+    atomic_uint serving;
+    lock_stats stats;
+} ticket_lock;
+
+typedef struct McsNode {
+    struct McsNode *volatile next;
+    volatile bool waiting;
+} mcs_node;
+
+typedef struct McsLock {
+    atomic_ptr tail; /* The last waiter, or the holder if nobody's waiting, NULL when free */
+    lock_stats stats;
+} mcs_lock;
+
+#define TICKET_LOCK(lock_name) {.stats = {.name = (lock_name)}}
+#define MCS_LOCK(lock_name) {.stats = {.name = (lock_name)}}
+
+void ticket_init(ticket_lock *lock, const char *name);
+void ticket_acquire(ticket_lock *lock);
+void ticket_release(ticket_lock *lock);
+uint32_t ticket_acquire_irqsave(ticket_lock *lock);
+void ticket_release_irqrestore(ticket_lock *lock, uint32_t flags);
+
+void mcs_init(mcs_lock *lock, const char *name);
+void mcs_acquire(mcs_lock *lock, mcs_node *node);
+void mcs_release(mcs_lock *lock, mcs_node *node);
+uint32_t mcs_acquire_irqsave(mcs_lock *lock, mcs_node *node);
+void mcs_release_irqrestore(mcs_lock *lock, mcs_node *node, uint32_t flags);
+
+void print_lock_stats();
+void reset_lock_stats();
+
+#endif // LOCK_H_
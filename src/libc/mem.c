@@ -1,8 +1,10 @@
 #include "mem.h"
 #include "../drivers/screen.h"
 #include "linkedlist.h"
+#include "lock.h"
 #include "meta.h"
 #include "string.h"
+#include "trace.h"
 
 ////////// Utilities //////////
 
@@ -258,8 +260,10 @@ void merge_free() {
     }
 }
 
-const size_t FREE_MEM_START = 0x10000;
-const size_t FREE_MEM_END = 0x40000;
+/* The heap starts on the first page after the kernel image and its BSS,
+ * and ends below the boot stack (which grows down from 0x90000) */
+#define FREE_MEM_START ALIGN_A(END, PAGE_SIZE)
+const size_t FREE_MEM_END = 0x80000;
 const bool ALIGN = true;
 const size_t ALIGN_SIZE = 0x1000;
 const enum FitType FIT_TYPE = BEST;
@@ -268,7 +272,7 @@ void init_memory() {
     free = create_node(FREE_MEM_START, FREE_MEM_END - FREE_MEM_START);
 }
 
-size_t kmalloc(size_t size) {
+static size_t allocate(size_t size) {
     if (ALIGN && (size % ALIGN_SIZE != 0)) {
         size += ALIGN_SIZE - (size % ALIGN_SIZE);
     }
@@ -322,13 +326,32 @@ size_t kmalloc(size_t size) {
     return address;
 }
 
+/* Threads can be preempted part way through changing the lists, and other CPUs could get at them,
+ * so every way in holds the heap lock with interrupts off */
+static mcs_lock heap_lock = MCS_LOCK("heap");
+
+#define WITH_HEAP_LOCKED(statement)                                      \
+    {                                                                    \
+        mcs_node __node;                                                 \
+        uint32_t __flags = mcs_acquire_irqsave(&heap_lock, &__node);     \
+        statement;                                                       \
+        mcs_release_irqrestore(&heap_lock, &__node, __flags);            \
+    }
+
+size_t kmalloc(size_t size) {
+    size_t address;
+    WITH_HEAP_LOCKED(address = allocate(size));
+    TRACE(TRACE_KMALLOC, address, size < 0xFFFF ? size : 0xFFFF);
+    return address;
+}
+
 size_t kcalloc(size_t n, size_t size) {
     return kmalloc(n * size);
 }
 
 size_t krealloc(size_t address, size_t size);
 
-void kfree(size_t address) {
+static void release(size_t address) {
     memorynode *target = find(allocated, address);
     if (target == NULL)
         return;
@@ -339,11 +362,19 @@ void kfree(size_t address) {
     merge_free();
 }
 
-memory_info mem_info() {
+void kfree(size_t address) {
+    TRACE(TRACE_KFREE, address, 0);
+    WITH_HEAP_LOCKED(release(address));
+}
+
+static memory_info collect_info() {
     int free_total = 0;
+    size_t largest_gap = 0;
     memorynode *current = free;
     while (current != NULL) {
         free_total += current->size;
+        if (current->size > largest_gap)
+            largest_gap = current->size;
         current = current->next;
     }
 
@@ -360,6 +391,7 @@ memory_info mem_info() {
         .allocated = allocated_total,
         .allocations = length(allocated),
         .gaps = length(free),
+        .largest_gap = largest_gap,
         .start = FREE_MEM_START,
         .end = FREE_MEM_END - 1,
     };
@@ -367,6 +399,12 @@ memory_info mem_info() {
     return result;
 }
 
+memory_info mem_info() {
+    memory_info info;
+    WITH_HEAP_LOCKED(info = collect_info());
+    return info;
+}
+
 void print_memory() {
     memory_info info = mem_info();
     kprintlnf("Total Physical Memory: {i}kb", info.physical / 1024);
@@ -52,6 +52,7 @@ typedef struct MemoryInfo {
     size_t allocated;
     uint16_t allocations;
     uint16_t gaps;
+    size_t largest_gap;
     size_t start;
     size_t end;
 } memory_info;
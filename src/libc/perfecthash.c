@@ -0,0 +1,135 @@
+#include "perfecthash.h"
+#include "string.h"
+
+/* FNV-1a, with the seed folded into the offset basis */
+static uint32_t hash_key(const char *key, int length, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ (seed * 16777619u);
+    for (int i = 0; i < length; i++) {
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static const char *key_at(const perfect_hash *hash, int index) {
+    return *(const char *const *)((const uint8_t *)hash->keys + index * hash->stride);
+}
+
+#define BUCKET_SEED 0
+#define SLOT_SEED(displacement) ((displacement) + 1)
+
+#define NO_BUCKET 0xFFFF
+
+/**
+ * Builds a perfect hash over 'count' keys, the first at 'keys' and each following one 'stride' bytes later
+ * NULL keys are left out, so sparse tables can be hashed in place; the rest must be unique
+ * Returns false if no displacement could be found for some bucket, in which case the hash is unusable
+ */
+bool phash_build(perfect_hash *hash, const char *const *keys, size_t stride, int count) {
+    if (count > PHASH_MAX_KEYS)
+        return false;
+
+    hash->keys = keys;
+    hash->stride = stride;
+    hash->count = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (key_at(hash, i) != NULL)
+            hash->count++;
+    }
+
+    hash->buckets = hash->count / 2 + 1;
+    hash->size = 2 * hash->count + 1;
+
+    if (hash->buckets > PHASH_MAX_BUCKETS)
+        return false;
+
+    uint16_t bucket_of[PHASH_MAX_KEYS];
+    uint16_t bucket_size[PHASH_MAX_BUCKETS];
+
+    for (int i = 0; i < hash->buckets; i++) {
+        bucket_size[i] = 0;
+        hash->displacements[i] = 0;
+    }
+    for (int i = 0; i < hash->size; i++)
+        hash->slots[i] = 0;
+
+    for (int i = 0; i < count; i++) {
+        const char *key = key_at(hash, i);
+        if (key == NULL) {
+            bucket_of[i] = NO_BUCKET;
+            continue;
+        }
+
+        bucket_of[i] = hash_key(key, strlen(key), BUCKET_SEED) % hash->buckets;
+        bucket_size[bucket_of[i]]++;
+    }
+
+    /* Place the fullest buckets first, while the table is still mostly empty */
+    for (int size = hash->count; size > 0; size--) {
+        for (int bucket = 0; bucket < hash->buckets; bucket++) {
+            if (bucket_size[bucket] != size)
+                continue;
+
+            int displacement;
+            for (displacement = 0; displacement < 256; displacement++) {
+                uint16_t placed[PHASH_MAX_KEYS];
+                int placed_count = 0;
+                bool fits = true;
+
+                for (int i = 0; fits && i < count; i++) {
+                    if (bucket_of[i] != bucket)
+                        continue;
+
+                    const char *key = key_at(hash, i);
+                    uint16_t slot = hash_key(key, strlen(key), SLOT_SEED(displacement)) % hash->size;
+
+                    if (hash->slots[slot] != 0)
+                        fits = false;
+                    else {
+                        hash->slots[slot] = i + 1;
+                        placed[placed_count++] = slot;
+                    }
+                }
+
+                if (fits)
+                    break;
+
+                /* Undo the partial placement and try the next displacement */
+                for (int i = 0; i < placed_count; i++)
+                    hash->slots[placed[i]] = 0;
+            }
+
+            if (displacement == 256)
+                return false;
+
+            hash->displacements[bucket] = displacement;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Looks up a key of the given length (it does not need to be null terminated)
+ * Returns the index of the key, or -1 if it is not in the set
+ */
+int phash_lookup(const perfect_hash *hash, const char *key, int length) {
+    if (hash->count == 0)
+        return -1;
+
+    uint16_t bucket = hash_key(key, length, BUCKET_SEED) % hash->buckets;
+    uint16_t slot = hash_key(key, length, SLOT_SEED(hash->displacements[bucket])) % hash->size;
+
+    int index = hash->slots[slot] - 1;
+    if (index < 0)
+        return -1;
+
+    const char *candidate = key_at(hash, index);
+    for (int i = 0; i < length; i++) {
+        if (candidate[i] != key[i])
+            return -1;
+    }
+
+    return candidate[length] == '\0' ? index : -1;
+}
@@ -0,0 +1,30 @@
+#ifndef PERFECTHASH_H_
+#define PERFECTHASH_H_
+
+#include "../cpu/types.h"
+
+/* Hash-and-displace perfect hashing over a fixed set of string keys
+ * Each key first hashes into a bucket, and each bucket stores the displacement
+ * (hash seed) that sends all of its keys to distinct, otherwise unused slots.
+ * A lookup is then two hashes and a single slot probe, no matter how many keys there are. */
+
+#define PHASH_MAX_KEYS 256
+#define PHASH_MAX_SLOTS (2 * PHASH_MAX_KEYS + 1) // Tables are 2 * count + 1 slots
+#define PHASH_MAX_BUCKETS (PHASH_MAX_KEYS / 2)
+
+typedef struct PerfectHash {
+    /* Keys are read straight out of the caller's table, 'stride' bytes apart */
+    const char *const *keys;
+    size_t stride;
+    uint16_t count;
+
+    uint16_t buckets;
+    uint16_t size;
+    uint8_t displacements[PHASH_MAX_BUCKETS];
+    uint16_t slots[PHASH_MAX_SLOTS]; /* Key index + 1, 0 if the slot is empty */
+} perfect_hash;
+
+bool phash_build(perfect_hash *hash, const char *const *keys, size_t stride, int count);
+int phash_lookup(const perfect_hash *hash, const char *key, int length);
+
+#endif // PERFECTHASH_H_
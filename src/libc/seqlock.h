@@ -0,0 +1,43 @@
+#ifndef SEQLOCK_H_
+#define SEQLOCK_H_
+
+#include "../cpu/types.h"
+#include "atomic.h"
+
+/* Sequence locks, for a few words that one writer (e.g. an interrupt handler) updates and anyone reads
+ *
+ * The writer bumps the sequence before and after writing, so it's odd while an update is half done. Readers
+ * note it before reading and check it after, going again if it was odd or has moved, so they never see a torn
+ * update and never hold the writer up. x86 keeps stores in order and loads in order, so only the compiler
+ * needs stopping from moving the data accesses past the sequence. */
+
+typedef struct SeqLock {
+    atomic_uint sequence;
+} seqlock;
+
+#define SEQLOCK_INIT {ATOMIC_INIT(0)}
+
+static inline uint32_t seq_read_begin(const seqlock *lock) {
+    uint32_t sequence;
+    while ((sequence = atomic_load(&lock->sequence)) & 1)
+        cpu_relax();
+    return sequence;
+}
+
+/* Whether what was read since seq_read_begin has to be read again */
+static inline bool seq_read_retry(const seqlock *lock, uint32_t sequence) {
+    asm volatile("" : : : "memory");
+    return atomic_load(&lock->sequence) != sequence;
+}
+
+/* Writers can't be interrupted by a reader on the same CPU, which would spin forever */
+static inline void seq_write_begin(seqlock *lock) {
+    atomic_store(&lock->sequence, atomic_load(&lock->sequence) + 1);
+    asm volatile("" : : : "memory");
+}
+
+static inline void seq_write_end(seqlock *lock) {
+    atomic_store(&lock->sequence, atomic_load(&lock->sequence) + 1);
+}
+
+#endif // SEQLOCK_H_
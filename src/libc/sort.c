@@ -0,0 +1,77 @@
+#include "sort.h"
+#include "mem.h"
+
+void insertion_sort(uint32_t *array, int length) {
+    for (int i = 1; i < length; i++) {
+        uint32_t value = array[i];
+        int j = i;
+        while (j > 0 && array[j - 1] > value) {
+            array[j] = array[j - 1];
+            j--;
+        }
+        array[j] = value;
+    }
+}
+
+/* Below this, insertion sort beats partitioning */
+#define QUICK_SORT_CUTOFF 12
+
+/**
+ * Quick sort with a median of three pivot, recursing into the smaller half so the stack stays O(log n)
+ */
+void quick_sort(uint32_t *array, int length) {
+    while (length > QUICK_SORT_CUTOFF) {
+        int middle = length / 2;
+        uint32_t a = array[0], b = array[middle], c = array[length - 1];
+        uint32_t pivot = a < b ? (b < c ? b : (a < c ? c : a)) : (a < c ? a : (b < c ? c : b));
+
+        int low = 0, high = length - 1;
+        while (low <= high) {
+            while (array[low] < pivot)
+                low++;
+            while (array[high] > pivot)
+                high--;
+            if (low <= high) {
+                uint32_t t = array[low];
+                array[low++] = array[high];
+                array[high--] = t;
+            }
+        }
+
+        /* [0, high] and [low, length) are left to sort */
+        if (high + 1 < length - low) {
+            quick_sort(array, high + 1);
+            array += low;
+            length -= low;
+        } else {
+            quick_sort(&array[low], length - low);
+            length = high + 1;
+        }
+    }
+
+    insertion_sort(array, length);
+}
+
+/**
+ * Top-down merge sort, 'scratch' has to hold 'length' values
+ */
+void merge_sort(uint32_t *array, uint32_t *scratch, int length) {
+    if (length < 2)
+        return;
+
+    int middle = length / 2;
+    merge_sort(array, scratch, middle);
+    merge_sort(&array[middle], scratch, length - middle);
+
+    if (array[middle - 1] <= array[middle])
+        return;
+
+    int left = 0, right = middle, out = 0;
+    while (left < middle && right < length)
+        scratch[out++] = array[right] < array[left] ? array[right++] : array[left++];
+    while (left < middle)
+        scratch[out++] = array[left++];
+
+    /* Anything left on the right is already in place */
+    memory_copy((uint8_t *)scratch, (uint8_t *)array, out * sizeof(uint32_t));
+}
@@ -0,0 +1,11 @@
+#ifndef SORT_H_
+#define SORT_H_
+
+#include "../cpu/types.h"
+
+/* Plain in-place sorts of unsigned values, ascending */
+void insertion_sort(uint32_t *array, int length);
+void quick_sort(uint32_t *array, int length);
+void merge_sort(uint32_t *array, uint32_t *scratch, int length);
+
+#endif // SORT_H_
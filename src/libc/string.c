@@ -19,6 +19,19 @@ void int_to_ascii(int n, char str[]) {
     reverse(str);
 }
 
+/* K&R atoi, skipping leading spaces and stopping at the first non-digit */
+int ascii_to_int(const char s[]) {
+    int i, n, sign;
+    for (i = 0; s[i] == ' '; i++)
+        ;
+    sign = (s[i] == '-') ? -1 : 1;
+    if (s[i] == '+' || s[i] == '-')
+        i++;
+    for (n = 0; s[i] >= '0' && s[i] <= '9'; i++)
+        n = 10 * n + (s[i] - '0');
+    return sign * n;
+}
+
 const char hex[] = "0123456789abcdef";
 
 void hex_to_ascii(int n, char str[]) {
@@ -165,6 +178,16 @@ int strcmp(const char s1[], const char s2[]) {
     return s1[i] - s2[i];
 }
 
+/* Like strcmp, but only compares up to the first n characters */
+int strncmp(const char s1[], const char s2[], int n) {
+    int i;
+    for (i = 0; i < n && s1[i] == s2[i]; i++) {
+        if (s1[i] == '\0')
+            return 0;
+    }
+    return i == n ? 0 : s1[i] - s2[i];
+}
+
 bool strbeginswith(const char s1[], const char s2[], int *rest) {
     int i;
     for (i = 0; s2[i] != '\0'; i++) {
@@ -176,3 +199,37 @@ bool strbeginswith(const char s1[], const char s2[], int *rest) {
 
     return true;
 }
+
+bool slice_equals(slice s, const char str[]) {
+    return strncmp(s.start, str, s.length) == 0 && str[s.length] == '\0';
+}
+
+/**
+ * Checks whether 'part' appears anywhere in 's'
+ */
+bool slice_contains(slice s, slice part) {
+    for (int i = 0; i + part.length <= s.length; i++) {
+        if (strncmp(&s.start[i], part.start, part.length) == 0)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Takes the next line off the front of 'text', without its newline
+ * Returns false once there's nothing left
+ */
+bool slice_next_line(slice *text, slice *line) {
+    if (text->length == 0)
+        return false;
+
+    line->start = text->start;
+    line->length = 0;
+    while (line->length < text->length && line->start[line->length] != '\n')
+        line->length++;
+
+    int consumed = line->length < text->length ? line->length + 1 : line->length;
+    text->start += consumed;
+    text->length -= consumed;
+    return true;
+}
@@ -4,6 +4,7 @@
 #include "../cpu/types.h"
 
 void int_to_ascii(int n, char str[]);
+int ascii_to_int(const char s[]);
 void hex_to_ascii(int n, char str[]);
 void uint_to_ascii(unsigned int n, char str[]);
 void uhex_to_ascii(unsigned int n, char str[]);
@@ -14,6 +15,17 @@ int strlen(const char s[]);
 void backspace(char s[]);
 void append(char s[], char n);
 int strcmp(const char s1[], const char s2[]);
+int strncmp(const char s1[], const char s2[], int n);
 bool strbeginswith(const char s1[], const char s2[], int *rest);
 
+/* A view into part of a string, which does not need to be null terminated */
+typedef struct Slice {
+    const char *start;
+    int length;
+} slice;
+
+bool slice_equals(slice s, const char str[]);
+bool slice_contains(slice s, slice part);
+bool slice_next_line(slice *text, slice *line);
+
 #endif
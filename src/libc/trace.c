@@ -0,0 +1,137 @@
+#include "trace.h"
+#include "../cpu/clock.h"
+#include "../cpu/info.h"
+#include "../cpu/smp.h"
+#include "../drivers/debugcon.h"
+#include "../drivers/screen.h"
+#include "atomic.h"
+#include "mem.h"
+#include "string.h"
+
+volatile uint32_t trace_events = 0;
+
+static trace_record *ring = NULL;
+static atomic_uint head = ATOMIC_INIT(0); /* Records ever written, the next goes at head % TRACE_RING_SIZE */
+
+static const char *event_names[TRACE_EVENTS] = {
+    "irq_entry", "irq_exit", "schedule", "dispatch", "dispatch_end", "kmalloc", "kfree", "key",
+};
+
+/* What 'trace start' takes, each a set of events */
+static const struct {
+    const char *name;
+    uint32_t events;
+} groups[] = {
+    {"irq", (1 << TRACE_IRQ_ENTRY) | (1 << TRACE_IRQ_EXIT)},
+    {"schedule", (1 << TRACE_SCHEDULE) | (1 << TRACE_DISPATCH) | (1 << TRACE_DISPATCH_END)},
+    {"heap", (1 << TRACE_KMALLOC) | (1 << TRACE_KFREE)},
+    {"key", 1 << TRACE_KEY},
+};
+#define GROUP_COUNT (int)(sizeof(groups) / sizeof(groups[0]))
+
+/**
+ * Takes a slot by bumping the head, so writers on any CPU (or an IRQ landing mid-write) get their own
+ */
+void trace_write(uint8_t event, uint32_t arg, uint16_t extra) {
+    trace_record *record = &ring[atomic_fetch_add(&head, 1) & (TRACE_RING_SIZE - 1)];
+    record->timestamp = rdtsc();
+    record->arg = arg;
+    record->extra = extra;
+    record->event = event;
+    record->cpu = this_cpu()->index;
+}
+
+/**
+ * Returns the events in the group called 'name', 0 if there's no such group
+ */
+uint32_t trace_group(slice name) {
+    for (int i = 0; i < GROUP_COUNT; i++) {
+        if (slice_equals(name, groups[i].name))
+            return groups[i].events;
+    }
+    return 0;
+}
+
+/**
+ * Empties the ring and starts tracing 'events', the ring coming off the heap the first time
+ * Returns false if there isn't the memory for it
+ */
+bool trace_start(uint32_t events) {
+    trace_events = 0;
+    if (ring == NULL)
+        ring = (trace_record *)kmalloc(TRACE_RING_SIZE * sizeof(trace_record));
+    if (ring == NULL)
+        return false;
+
+    atomic_store(&head, 0);
+    trace_events = events;
+    return true;
+}
+
+void trace_stop() {
+    trace_events = 0;
+}
+
+/* Writes a record out as hex, byte by byte as it sits in memory */
+static void dump_record(const trace_record *record) {
+    static const char digits[] = "0123456789abcdef";
+    char line[6 + 2 * sizeof(trace_record) + 1];
+    memory_copy((uint8_t *)"trace ", (uint8_t *)line, 6);
+
+    const uint8_t *bytes = (const uint8_t *)record;
+    for (size_t i = 0; i < sizeof(trace_record); i++) {
+        line[6 + 2 * i] = digits[bytes[i] >> 4];
+        line[6 + 2 * i + 1] = digits[bytes[i] & 0xF];
+    }
+    line[sizeof(line) - 1] = '\n';
+    debug_write(line, sizeof(line));
+}
+
+/**
+ * Stops tracing and streams the ring out of the debug port, oldest first
+ * A JSON header with the TSC rate and event names, a 'trace <hex>' line per record, then a JSON footer
+ */
+void trace_dump() {
+    trace_stop();
+    if (ring == NULL) {
+        kprintln("Nothing has been traced, 'trace start' first");
+        return;
+    }
+
+    uint32_t written = atomic_load(&head);
+    uint32_t count = written < TRACE_RING_SIZE ? written : TRACE_RING_SIZE;
+
+    debug_print("{\"trace\":\"begin\",\"records\":");
+    debug_print_uint(count);
+    debug_print(",\"khz\":");
+    debug_print_uint(clock_khz());
+    debug_print(",\"events\":[");
+    for (int i = 0; i < TRACE_EVENTS; i++) {
+        debug_print(i == 0 ? "\"" : ",\"");
+        debug_print(event_names[i]);
+        debug_print("\"");
+    }
+    debug_print("]}\n");
+
+    for (uint32_t i = written - count; i != written; i++)
+        dump_record(&ring[i & (TRACE_RING_SIZE - 1)]);
+
+    debug_print("{\"trace\":\"end\"}\n");
+    kprintlnf("Dumped {u} records to the debug port, {u} older ones were overwritten", count, written - count);
+}
+
+void print_trace_status() {
+    uint32_t written = atomic_load(&head);
+    kprint("Tracing:");
+    if (trace_events == 0)
+        kprint(" nothing");
+    for (int i = 0; i < GROUP_COUNT; i++) {
+        if (trace_events & groups[i].events) {
+            kprint(" ");
+            kprint(groups[i].name);
+        }
+    }
+    kprintln("");
+    kprintlnf("{u} records in the ring of {u}", written < TRACE_RING_SIZE ? written : TRACE_RING_SIZE,
+        TRACE_RING_SIZE);
+}
@@ -0,0 +1,51 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include "../cpu/types.h"
+#include "string.h"
+
+/* Static tracepoints
+ *
+ * Each TRACE() site is compiled in for good, and checks its event's bit in trace_events, so one that's off
+ * costs a load and a branch the CPU learns is never taken. One that's on writes a 16 byte record stamped
+ * with the TSC into a ring, overwriting the oldest once it's full. 'trace dump' streams the ring out of the
+ * debug port, and nix/trace_to_chrome.py turns that into trace-viewer JSON. */
+#define TRACE_RING_SIZE 2048 // Records, must be a power of two
+
+enum TraceEvent {
+    TRACE_IRQ_ENTRY,    /* arg: vector */
+    TRACE_IRQ_EXIT,     /* arg: vector */
+    TRACE_SCHEDULE,     /* arg: task, extra: priority */
+    TRACE_DISPATCH,     /* arg: task, the scheduler loop starting it */
+    TRACE_DISPATCH_END, /* arg: task */
+    TRACE_KMALLOC,      /* arg: address, extra: size (saturated) */
+    TRACE_KFREE,        /* arg: address */
+    TRACE_KEY,          /* arg: keycode, extra: flags */
+    TRACE_EVENTS
+};
+
+typedef struct TraceRecord {
+    uint64_t timestamp; /* TSC */
+    uint32_t arg;
+    uint16_t extra;
+    uint8_t event;
+    uint8_t cpu;
+} trace_record;
+
+extern volatile uint32_t trace_events; /* Bit n set while event n is being traced */
+
+#define TRACE(event, arg, extra)                                        \
+    do {                                                                \
+        if (__builtin_expect(trace_events & (1u << (event)), 0))        \
+            trace_write((event), (uint32_t)(arg), (uint16_t)(extra));   \
+    } while (0)
+
+void trace_write(uint8_t event, uint32_t arg, uint16_t extra);
+
+uint32_t trace_group(slice name);
+bool trace_start(uint32_t events);
+void trace_stop();
+void trace_dump();
+void print_trace_status();
+
+#endif // TRACE_H_